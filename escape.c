@@ -7,6 +7,9 @@
 //  email s3301419@student.rug.nl
 // o=================================o
 
+// needed for pthreads and sysconf when compiling with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
@@ -15,12 +18,65 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
+
+// the state lookup uses SSE2 when the compiler supports
+// it, if you dont want that, just: #define NOSIMD
+#if !defined(NOSIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// make the compiler inline a function even if it thinks its too big, this
+// is used to specialize simulateTurn for every combination of settings
+#if defined(__GNUC__) || defined(__clang__)
+#define FORCE_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline
+#endif
+
+// start loading the memory at p into the cache, without waiting for it
+#if defined(__GNUC__) || defined(__clang__)
+#define prefetch(p) __builtin_prefetch(p)
+#elif defined(USE_SSE2)
+#define prefetch(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define prefetch(p) ((void)(p))
+#endif
+
+// the reproduce command (outside of rngmode compat) runs in parallel on all cores
+// if you dont want that (or cant link pthreads), just: #define NOTHREADS
+#ifndef NOTHREADS
+#ifdef _WIN32
+#include <process.h>
+#include <intrin.h>
+// declared here so we dont have to include the gigantic windows.h
+__declspec(dllimport) unsigned long __stdcall WaitForSingleObject(void *handle, unsigned long milliseconds);
+__declspec(dllimport) int __stdcall CloseHandle(void *handle);
+__declspec(dllimport) unsigned long __stdcall GetActiveProcessorCount(unsigned short groupNumber);
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
 
 // room/agent constraints
 enum {
 	MAX_ROOM_SIZE = 9,
 	MAX_AGENTS = MAX_ROOM_SIZE * MAX_ROOM_SIZE,
 	MAX_HEALTH = 2,
+	MAX_CELLS = MAX_ROOM_SIZE * MAX_ROOM_SIZE,
+};
+
+// the agents can take 5 actions, see the action enum
+enum {
+	NUM_ACTIONS = 5,
+	ARENA_BLOCK = 4096, // how many states the sparse Q-table allocates at once
+	RAND_BUFFER = 256,  // how many random numbers the environment generates at once
+	RAND_LANES = 4,     // how many streams those come from with useRandLanes
+	CYCLE_WINDOW = 16,  // how many turns back simulateTurn looks for a repeat
 };
 
 // what the room can contain
@@ -56,82 +112,461 @@ typedef enum action {
 	UP,
 } action;
 
+// what the agents see in each of their visible cells
+enum {
+	DEACTIVATED, // e.g. FLOOR (static) or DOOR (dynamic)
+	ACTIVATED,   // OPEN_DOOR, BROKEN_GLASS, and BANDAGE
+	HAS_AGENT    // overrides all other cell states above
+};
+
+// the agents can see cells around them in a crosshair:
+//       [ ]
+//       [ ]
+// [ ][ ] @ [ ][ ]
+//       [ ]
+//       [ ]
+// the arrays below store corrdinate offsets of the visible cells
+const int visionX[8] = { -2, -1, 1, 2,  0,  0, 0, 0 };
+const int visionY[8] = {  0,  0, 0, 0, -2, -1, 1, 2 };
+
+// what each cell looks like to an agent when nobody stands on it
+// indexed by the cell character, everything not listed is DEACTIVATED
+const unsigned char cellVision[256] = {
+	[SHARDS]    = ACTIVATED,
+	[OPEN_DOOR] = ACTIVATED,
+	[BANDAGE]   = ACTIVATED,
+};
+
 typedef struct agent {
 	int x, y;   // when x or y == ESCAPED, the agent has escaped
 	int health; // when health is 0, agent is dead
 } agent;
 
+// a set of cells in the room, one bit per cell at index x * MAX_ROOM_SIZE + y
+// since MAX_CELLS <= 128 the whole room fits in 2 words
+typedef struct board {
+	uint64_t bits[2];
+} board;
+
 // we use a PCG generator: http://www.pcg-random.org/
 // this type holds the state of the RNG, initialize it with seedRNG
-typedef uint64_t rng;
-
-int  roomWidth;
-int  roomHeight;
-char room[MAX_ROOM_SIZE][MAX_ROOM_SIZE];
-int numAgents;
-agent agents[MAX_AGENTS];
-
-// we store a copy at the room when running an epoch
-// so that we can "reset" to the original configuration
-// when the epoch ends by copying it back
-char backupRoom[sizeof(room)];
-char backupAgents[sizeof(agents)];
-
-// dimensions of the Q-table:
-//   2   - we need 2 tables for double Q
-// (9x9) - agent position in the room
-//   2   - 2 or 1 health
-// (3^8) - each agent sees 8 cells and each cell can have 3 state
-//   5   - number of actions the agent can take
-// = 10,628,820 entries (1,062,882 states)
-double qTable[2][MAX_ROOM_SIZE][MAX_ROOM_SIZE][MAX_HEALTH][3][3][3][3][3][3][3][3][5];
-
-double totalReward; // total reward obtained by ALL agents combined over 1 epoch
-rng globalRNG;
-int currEpoch;
-int currTurn;
-int maxSteps = 200; // how many turns to do per epoch
-bool printEpochs = TRUE; // if TRUE, then results are printed to console after every epoch
-
-// Q learning parameters
-double alpha = 0.5;
-double gamma = 0.95;
-double epsilon = 0.05;
-double optimism = 50;
-double escapeReward	   = +1000;
-double deathPunishment = -1000;
-double idlePunishment  = -1;
-bool useDoubleQ = FALSE; // if TRUE, then use double Q-learning
-bool useEpsilon = TRUE; // if TRUE, then use epsilon greedy, otherwise just use greedy
-
-FILE *resultsFile; // store results in this file
+// the increment picks 1 of 2^63 streams which never overlap, see seedStream
+typedef struct rng {
+	uint64_t state;
+	uint64_t increment;
+} rng;
+
+#define PCG_MULTIPLIER 6364136223846793005u
+#define PCG_INCREMENT  1442695040888963407u
+
+// how the values in the Q-table are stored, see getQ and setQ
+typedef enum precision {
+	PRECISION_DOUBLE, // 8 bytes per value
+	PRECISION_FLOAT,  // 4 bytes per value
+	PRECISION_INT16,  // 2 bytes per value, in fixed point with 1 scale for the whole table
+	PRECISION_INT8,   // 1 byte per value, all 5 values of a state share a power of 2 scale
+} precision;
+
+const char *precisionNames[] = { "double", "float", "int16", "int8" };
+
+// the 5 values of a state in 1 of the Q-tables, in whatever precision
+// the Q-table uses, so always go through getQ, setQs, and updateQWith
+typedef struct qentry qentry;
+
+// the Q-table and the parameters the agents use to learn with it
+// multiple environments can share a single learner
+typedef struct learner {
+	// dimensions of the Q-table:
+	//   2   - we need 2 tables for double Q
+	// (wxh) - agent position in the room, but not on walls
+	//   2   - 2 or 1 health
+	// (3^8) - each agent sees 8 cells and each cell can have 3 state
+	//   5   - number of actions the agent can take
+	// but most cells can only ever be in 1 or 2 of the 3 vision states
+	// (a wall never has an agent and is never activated) so allocQTable
+	// looks at the room, and for every cell an agent can stand on only
+	// makes room for the states it can actually see from there
+	// qTable[0] and qTable[1] are the 2 tables which are indexed by
+	// getStateIndex, and qTable[1] is only allocated when double Q is on
+	// the states of both tables are rowBytes apart
+	unsigned char *qTable[2];
+	size_t numStates;
+	size_t rowBytes;
+
+	// with useAlignedQ the dense tables are interleaved instead: every state
+	// gets 1 row, aligned to a power of 2 so that it never straddles 2 cache
+	// lines, with the values of the first table followed by those of the
+	// second - qTable[0] and qTable[1] then point into the same allocation
+	// (qMemory) so a lookup only ever touches 1 row
+	bool useAlignedQ;
+	bool tableAligned;
+	void *qMemory;
+
+	// the values are stored with tablePrecision, which allocQTable
+	// changes to usePrecision, each state takes up entryBytes
+	precision usePrecision;
+	precision tablePrecision;
+	int entryBytes;
+	double fixedScale; // with PRECISION_INT16, the Q-value x is stored as x * fixedScale
+
+	// the room the Q-table was laid out for
+	int tableWidth;
+	int tableHeight;
+	char layout[MAX_ROOM_SIZE][MAX_ROOM_SIZE];
+
+	// the layout of the states, for the cell at index x * MAX_ROOM_SIZE + y:
+	// the index of its first state (or NONE for walls), the number of vision
+	// states per health, and what every visible cell adds to the index
+	// when it has an agent on it, or when it is ACTIVATED
+	int cellOffset[MAX_CELLS];
+	int cellStates[MAX_CELLS];
+	short agentWeight[MAX_CELLS][8];
+	short activeWeight[MAX_CELLS][8];
+
+	// the sparse backend only stores the states that were visited since the
+	// last reset: a hash map (open addressing) from state index + 1 to an
+	// entry in the arena, which holds the values of the first table
+	// followed by the values of the second table when double Q is on
+	// the dense backend above is unused when useSparseQ is TRUE, and the
+	// other way around - see lookupQEntry
+	bool useSparseQ;
+	uint32_t *hashKeys;    // 0 for empty slots
+	uint32_t *hashEntries; // index of the entry in the arena
+	size_t hashCapacity;   // always a power of 2
+	size_t numEntries;
+	unsigned char **arena; // blocks of ARENA_BLOCK entries
+	size_t numBlocks;
+	int entrySize;         // entryBytes or 2 * entryBytes with double Q
+
+	// filling all 10 million entries every time the Q-table is reset is slow, so
+	// instead each state is stamped with the generation in which it was last
+	// initialized - resetting just starts a new generation, and states from an
+	// older generation are set to optimism the first time they are looked up
+	uint32_t *qStamps;
+	uint32_t qGeneration;
+
+	// with useBestCache every state also remembers its greedy actions (BEST_A,
+	// BEST_B and BEST_AB below) so that picking one is a single lookup instead
+	// of comparing all 5 values - learnQWith keeps them up to date, and only has to
+	// look at all 5 values again when the best one got worse
+	// the cache is laid out for double Q or not (bestDoubleQ) as it was when
+	// allocQTable last made the table, without double Q only BEST_A is kept
+	bool useBestCache;
+	bool bestDoubleQ;
+	unsigned char (*qBest)[3]; // indexed by state index, NULL without the cache
+
+	// changes every time entries we looked up before might have moved, or
+	// been reset - by allocQTable and loadQTable
+	uint32_t tableVersion;
+
+	// Q learning parameters
+	double alpha;
+	double gamma;
+	double epsilon;
+	double optimism;
+	double escapeReward;
+	double deathPunishment;
+	double idlePunishment;
+	bool useDoubleQ; // if TRUE, then use double Q-learning
+	bool useEpsilon; // if TRUE, then use epsilon greedy, otherwise just use greedy
+} learner;
+
+// where the environment gets its random numbers from, see env
+typedef enum rngmode {
+	RNG_COMPAT,
+	RNG_LANES,
+	RNG_STREAMS,
+} rngmode;
+
+const char *rngModeNames[] = { "compat", "lanes", "streams" };
+
+// how agents that want to move onto the same cell get bumped, see simulateTurn
+typedef enum bumpmode {
+	BUMP_CHAINS,
+	BUMP_CLAIMS,
+} bumpmode;
+
+const char *bumpModeNames[] = { "chains", "claims" };
+
+// the greedy actions of a state the Q-table can cache: the action
+// with the highest value in the first table, the second table,
+// or both tables together (used by double Q)
+enum { BEST_A, BEST_B, BEST_AB };
+
+// a room with agents trying to escape it, and everything
+// else needed to simulate it - see simulateTurn
+typedef struct env {
+	int  roomWidth;
+	int  roomHeight;
+	char room[MAX_ROOM_SIZE][MAX_ROOM_SIZE]; // for the GUI and file I/O, the simulation uses the boards
+	int numAgents;
+	agent agents[MAX_AGENTS];
+
+	// how many agents stand on each cell, and the (lowest) index of the agent
+	// standing there or NONE - this is kept up to date as the agents move
+	// around, so we never have to loop over all agents to find one
+	unsigned char occupancy[MAX_ROOM_SIZE][MAX_ROOM_SIZE];
+	signed char agentMap[MAX_ROOM_SIZE][MAX_ROOM_SIZE];
+
+	// indices of the agents that are still in the room, in order - this is
+	// rebuilt by updateOccupancy and shrunk by simulateTurn as agents escape
+	// or die, so a turn only costs as much as the agents that are left
+	int active[MAX_AGENTS];
+	int numActive;
+
+	// the room again, as a board for every kind of cell the simulation cares
+	// about - these are kept in sync with room[][] by setCell and updateBoards
+	board passable;  // FLOOR, SHARDS, OPEN_DOOR, BANDAGE, EXIT
+	board activated; // SHARDS, OPEN_DOOR, BANDAGE
+	board glass;
+	board door;
+	board shards;
+	board bandage;
+	board exit;
+	board occupied;  // cells with at least 1 agent on them, kept with occupancy
+
+	// flat indices of the 8 cells visible from each cell (see getQEntry)
+	// visible cells outside of the room point at MAX_CELLS, which is never
+	// set in any board, this only depends on the room size so it is rebuilt
+	// by updateNeighbours whenever the room is loaded or resized
+	unsigned char neighbours[MAX_CELLS][8];
+
+	// where each action takes an agent standing on each cell, by flat index:
+	// the cell it ends up on, or MAX_CELLS + the cell that blocked it (a
+	// wall, glass or a door) - updateBoards builds this from the passable
+	// board, and setCell patches the moves that go onto the cell it changed
+	unsigned char moves[MAX_CELLS][NUM_ACTIONS];
+
+	// we store a copy at the room when running an epoch
+	// so that we can "reset" to the original configuration
+	// when the epoch ends by copying it back
+	char backupRoom[MAX_ROOM_SIZE * MAX_ROOM_SIZE];
+	char backupAgents[MAX_AGENTS * sizeof(agent)];
+
+	double totalReward; // total reward obtained by ALL agents combined over 1 epoch
+
+	// with BUMP_CHAINS the agents are bumped one by one by following the
+	// chains of agents in the collision map, with BUMP_CLAIMS all at once
+	// by counting claims on each cell (see resolveClaims) - the agents end
+	// up in the same place either way
+	bumpmode bumpMode;
+
+	// the simulation takes its random numbers from randBuffer, which nextRand
+	// fills RAND_BUFFER at a time - with RNG_COMPAT from rng, so that the
+	// numbers come out in exactly the same order as when they were drawn one
+	// by one (reproduce only gives the published results this way, because
+	// then all of its runs go on drawing from that 1 stream), or with
+	// RNG_LANES from RAND_LANES interleaved streams instead,
+	// which is faster but doesnt give the same results as the paper anymore
+	// with RNG_STREAMS every agent draws from its own stream in agentRNG, so
+	// what 1 agent gets doesnt depend on how many numbers the others took
+	rngmode rngMode;
+	int seed; // what seedEnv was last called with
+	rng rng;
+	rng lanes[RAND_LANES];
+	rng agentRNG[MAX_AGENTS];
+	uint32_t randBuffer[RAND_BUFFER];
+	int randNext; // the next unused number in randBuffer
+	int currEpoch;
+	int currTurn;
+	int maxSteps; // how many turns to do per epoch
+	bool printEpochs; // if TRUE, then results are printed to console after every epoch
+	FILE *resultsFile; // store results in this file
+	double *epochRewards; // if not NULL, the total reward of every epoch is also stored here
+	int *epochEscapes;    // if not NULL, how many agents escaped in every epoch is stored here
+	int numEscaped;       // how many agents escaped so far this epoch
+
+	// if TRUE, the agents only follow the policy in the Q-table, and simulateTurn
+	// never writes to it - states that were never visited are not initialized,
+	// but treated as if they were, so any number of envs can share 1 learner
+	bool readOnly;
+
+	learner *learner; // the Q-table the agents learn from
+
+	// the Q-entries of the state each agent ended up in last turn, which is
+	// usually the state it starts the next turn in - so simulateTurn doesnt
+	// look them up again if the state index is the same and the Q-table
+	// didnt change in between (lastVersion is still its tableVersion)
+	struct {
+		int state; // or NONE
+		qentry *q0, *q1;
+	} lastEntries[MAX_AGENTS];
+	uint32_t lastVersion;
+
+	// when no random numbers decide anything, a turn that starts the same way
+	// as one of the last CYCLE_WINDOW turns (with the Q-table unchanged since)
+	// repeats the turns in between until the epoch ends, so if skipCycles is
+	// TRUE simulateTurn skips straight to the end of the epoch - changes counts
+	// the changes to the room and the agents that a turn cant undo, and
+	// stableTurns how many turns in a row didnt change the Q-table
+	bool skipCycles;
+	int changes;
+	int stableTurns;
+	struct {
+		int epoch, turn; // when the turn started like this
+		int changes;
+		int numActive;
+		uint64_t hash;
+		uint16_t agents[MAX_AGENTS]; // cell and health of each active agent
+	} pastTurns[CYCLE_WINDOW];
+} env;
+
+// the learner and environment used by the CLI and GUI
+learner globalLearner = {
+	.alpha = 0.5,
+	.gamma = 0.95,
+	.epsilon = 0.05,
+	.optimism = 50,
+	.escapeReward	 = +1000,
+	.deathPunishment = -1000,
+	.idlePunishment  = -1,
+	.useDoubleQ = FALSE,
+	.useEpsilon = TRUE,
+};
+env globalEnv = {
+	.rng = { 0, PCG_INCREMENT },
+	.randNext = RAND_BUFFER,
+	.maxSteps = 200,
+	.printEpochs = TRUE,
+	.learner = &globalLearner,
+	.skipCycles = TRUE,
+};
+
+int numThreads = 0; // how many threads the reproduce command uses, 0 means 1 per core
+
+// the increment of 1 of the 2^63 PCG streams, stream 0 is
+// the one the RNG always used (and which the paper used)
+uint64_t streamIncrement(uint64_t stream) {
+	if (stream == 0) {
+		return PCG_INCREMENT;
+	}
+	// streams whose increments are close together look alike, so mix it up
+	uint64_t x = stream * 0x9e3779b97f4a7c15u;
+	x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9u;
+	x = (x ^ x >> 27) * 0x94d049bb133111ebu;
+	return (x ^ x >> 31) << 1 | 1;
+}
+
+// initialize the PCG RNG with a seed, on the given stream
+rng seedStream(int seed, uint64_t stream) {
+	rng rng;
+	rng.increment = streamIncrement(stream);
+	rng.state = ((uint32_t)seed + rng.increment) * PCG_MULTIPLIER + rng.increment;
+	return rng;
+}
 
 // initialize the PCG RNG with a seed
 rng seedRNG(int seed) {
-	return
-		((uint32_t)seed + 1442695040888963407u)
-		* 6364136223846793005u
-		+ 1442695040888963407u;
+	return seedStream(seed, 0);
 }
 
-// get random float in [0,1]
-double randf(rng *rng) {
-	uint64_t x = *rng;
+// advance the RNG by delta steps, as if randu was called delta times,
+// but in log(delta) time - each step is state = state * mult + inc, and
+// doing that twice is the same as 1 step with mult^2 and inc * (mult + 1)
+void jumpRNG(rng *rng, uint64_t delta) {
+	uint64_t mult = PCG_MULTIPLIER;
+	uint64_t inc = rng->increment;
+	uint64_t totalMult = 1;
+	uint64_t totalInc = 0;
+	while (delta > 0) {
+		if (delta & 1) {
+			totalMult *= mult;
+			totalInc = totalInc * mult + inc;
+		}
+		inc *= mult + 1;
+		mult *= mult;
+		delta >>= 1;
+	}
+	rng->state = rng->state * totalMult + totalInc;
+}
+
+// get random 32-bit unsigned integer
+uint32_t randu(rng *rng) {
+	uint64_t x = rng->state;
 	uint32_t r = (uint32_t)(x >> 59);
-	*rng = x
-		* 6364136223846793005u
-		+ 1442695040888963407u;
+	rng->state = x
+		* PCG_MULTIPLIER
+		+ rng->increment;
 
 	x ^= x >> 18;
 	uint32_t y = (uint32_t)(x >> 27);
-	y = y >> r | y << ((uint32_t)(-(int)r) & 31);
+	return y >> r | y << ((uint32_t)(-(int)r) & 31);
+}
 
-	return y / (1.0 + UINT_MAX);
+// get random float in [0,1]
+double randf(rng *rng) {
+	return randu(rng) / (1.0 + UINT_MAX);
 }
 
-// get random agent action
-action randAction(rng *rng) {
-	return (action)(randf(rng) * (1.0 + UP));
+// the random action for the random integer r, this is the same as
+// what randf(rng) * 5 would round down to, but without floating point
+action randActionFrom(uint32_t r) {
+	return (action)(((uint64_t)r * NUM_ACTIONS) >> 32);
+}
+
+// random integers r below the returned threshold are exactly those
+// for which randf(rng) < p, so the comparison can be done on integers
+uint64_t randThreshold(double p) {
+	double threshold = ceil(p * (1.0 + UINT_MAX));
+	return threshold <= 0 ? 0 : threshold >= 1.0 + UINT_MAX ? (uint64_t)UINT_MAX + 1 : (uint64_t)threshold;
+}
+
+// start the lanes of the environment from its (single stream) RNG,
+// and throw away the random numbers that were generated already
+void resetRandBuffer(env *env) {
+	rng seeder = env->rng;
+	for (int l = 0; l < RAND_LANES; ++l) {
+		env->lanes[l].state = (uint64_t)randu(&seeder) << 32 | randu(&seeder);
+		env->lanes[l].increment = streamIncrement(1 + l);
+	}
+	env->randNext = RAND_BUFFER;
+}
+
+// seed all RNGs of the environment for the given run: every agent gets its own
+// stream, and every run starts 2^40 numbers further along in all the streams
+// so no 2 runs (or agents) ever use the same numbers, however they are
+// scheduled - run 0 of stream 0 is exactly seedRNG(seed)
+void seedEnvRun(env *env, int seed, int run) {
+	env->seed = seed;
+	env->rng = seedStream(seed, 0);
+	jumpRNG(&env->rng, (uint64_t)run << 40);
+	for (int a = 0; a < MAX_AGENTS; ++a) {
+		env->agentRNG[a] = seedStream(seed, 1 + RAND_LANES + a);
+		jumpRNG(&env->agentRNG[a], (uint64_t)run << 40);
+	}
+	resetRandBuffer(env);
+}
+
+// seed all RNGs of the environment
+void seedEnv(env *env, int seed) {
+	seedEnvRun(env, seed, 0);
+}
+
+// get the next random 32-bit unsigned integer of the environment
+uint32_t nextRand(env *env) {
+	if (env->randNext == RAND_BUFFER) {
+		if (env->rngMode == RNG_LANES) {
+			// the lanes dont depend on each other, so the CPU can advance them
+			// all at the same time - SSE2 has no 64-bit multiply, so this
+			// gets more out of it than actual vectors would
+			for (int i = 0; i < RAND_BUFFER; i += RAND_LANES) {
+				for (int l = 0; l < RAND_LANES; ++l) {
+					env->randBuffer[i + l] = randu(&env->lanes[l]);
+				}
+			}
+		} else {
+			for (int i = 0; i < RAND_BUFFER; ++i) {
+				env->randBuffer[i] = randu(&env->rng);
+			}
+		}
+		env->randNext = 0;
+	}
+	return env->randBuffer[env->randNext++];
+}
+
+// get the next random 32-bit unsigned integer for the given agent
+uint32_t agentRand(env *env, int agent) {
+	return env->rngMode == RNG_STREAMS ? randu(&env->agentRNG[agent]) : nextRand(env);
 }
 
 // clamp x between min and max
@@ -142,22 +577,10 @@ int clamp(int x, int min, int max) {
 }
 
 // return TRUE if (x,y) is inside of the room dimensions
-bool isInRoom(int x, int y) {
+bool isInRoom(env *env, int x, int y) {
 	return
-		x >= 0 && x < roomWidth &&
-		y >= 0 && y < roomHeight;
-}
-
-// returns the index of the agent at (x,y) or NONE if none is there
-int agentAt(int x, int y) {
-	if (isInRoom(x, y)) {
-		for (int a = 0; a < numAgents; ++a) {
-			if (agents[a].x == x && agents[a].y == y) {
-				return a;
-			}
-		}
-	}
-	return NONE;
+		x >= 0 && x < env->roomWidth &&
+		y >= 0 && y < env->roomHeight;
 }
 
 // return TRUE if agent could stand on the given cell
@@ -179,26 +602,953 @@ bool isPassable(char cell) {
 	}
 }
 
+// returns the index of the agent at (x,y) or NONE if none is there
+int agentAt(env *env, int x, int y) {
+	if (isInRoom(env, x, y)) {
+		return env->agentMap[x][y];
+	}
+	return NONE;
+}
+
+bool boardHas(const board *b, int cell) {
+	return (bool)((b->bits[cell >> 6] >> (cell & 63)) & 1);
+}
+
+// set or clear a single cell
+void boardPut(board *b, int cell, bool value) {
+	uint64_t bit = (uint64_t)1 << (cell & 63);
+	b->bits[cell >> 6] = value ? (b->bits[cell >> 6] | bit) : (b->bits[cell >> 6] & ~bit);
+}
+
+// modify (*x,*y) according to the given action
+void actionModCoords(env *env, action a, int *x, int *y) {
+	switch (a) {
+		case LEFT:	*x -= 1; break;
+		case RIGHT: *x += 1; break;
+		case DOWN:	*y -= 1; break;
+		case UP:	*y += 1; break;
+		default: /* STAY */ break;
+	}
+
+	*x = clamp(*x, 0, env->roomWidth  - 1);
+	*y = clamp(*y, 0, env->roomHeight - 1);
+}
+
+// work out where every action takes an agent standing on (x,y)
+void updateMovesFrom(env *env, int x, int y) {
+	for (action a = STAY; a <= UP; ++a) {
+		int dx = x;
+		int dy = y;
+		actionModCoords(env, a, &dx, &dy);
+		int cell = dx * MAX_ROOM_SIZE + dy;
+		env->moves[x * MAX_ROOM_SIZE + y][a] = (unsigned char)(boardHas(&env->passable, cell) ? cell : MAX_CELLS + cell);
+	}
+}
+
+// change a cell of the room in all the boards, but not in the moves
+void putCell(env *env, int x, int y, char c) {
+	int cell = x * MAX_ROOM_SIZE + y;
+	env->room[x][y] = c;
+	boardPut(&env->passable,  cell, isPassable(c));
+	boardPut(&env->activated, cell, cellVision[(unsigned char)c] == ACTIVATED);
+	boardPut(&env->glass,     cell, c == GLASS);
+	boardPut(&env->door,      cell, c == DOOR);
+	boardPut(&env->shards,    cell, c == SHARDS);
+	boardPut(&env->bandage,   cell, c == BANDAGE);
+	boardPut(&env->exit,      cell, c == EXIT);
+}
+
+// change a cell of the room and keep the boards up to date
+void setCell(env *env, int x, int y, char c) {
+	putCell(env, x, y, c);
+	++env->changes;
+
+	// only the moves onto (x,y) can have changed, which are
+	// the moves from (x,y) itself, and the 4 cells next to it
+	const int nextX[5] = { 0, -1, 1, 0, 0 };
+	const int nextY[5] = { 0, 0, 0, -1, 1 };
+	for (int i = 0; i < 5; ++i) {
+		if (isInRoom(env, x + nextX[i], y + nextY[i])) {
+			updateMovesFrom(env, x + nextX[i], y + nextY[i]);
+		}
+	}
+}
+
+// rebuild all the room boards from room[][], call this after
+// changing room[][] directly or resizing the room
+void updateBoards(env *env) {
+	++env->changes;
+	memset(&env->passable,  0, sizeof(board));
+	memset(&env->activated, 0, sizeof(board));
+	memset(&env->glass,     0, sizeof(board));
+	memset(&env->door,      0, sizeof(board));
+	memset(&env->shards,    0, sizeof(board));
+	memset(&env->bandage,   0, sizeof(board));
+	memset(&env->exit,      0, sizeof(board));
+	for (int x = 0; x < env->roomWidth; ++x) {
+		for (int y = 0; y < env->roomHeight; ++y) {
+			putCell(env, x, y, env->room[x][y]);
+		}
+	}
+	for (int x = 0; x < env->roomWidth; ++x) {
+		for (int y = 0; y < env->roomHeight; ++y) {
+			updateMovesFrom(env, x, y);
+		}
+	}
+}
+
+// rebuild the table of visible cells, call this after the room is resized
+void updateNeighbours(env *env) {
+	for (int x = 0; x < MAX_ROOM_SIZE; ++x) {
+		for (int y = 0; y < MAX_ROOM_SIZE; ++y) {
+			for (int vision = 0; vision < 8; ++vision) {
+				int cx = x + visionX[vision];
+				int cy = y + visionY[vision];
+				env->neighbours[x * MAX_ROOM_SIZE + y][vision] = (unsigned char)
+					(isInRoom(env, cx, cy) ? cx * MAX_ROOM_SIZE + cy : MAX_CELLS);
+			}
+		}
+	}
+}
+
+// recount which agents stand where from scratch, this needs to be
+// called whenever agents are added, removed, or moved around by
+// anything other than moveAgent
+void updateOccupancy(env *env) {
+	++env->changes;
+	memset(env->occupancy, 0, sizeof(env->occupancy));
+	memset(&env->occupied, 0, sizeof(env->occupied));
+	memset(env->agentMap, NONE, sizeof(env->agentMap)); // NONE == -1 == 0xFF
+	for (int a = env->numAgents - 1; a >= 0; --a) {
+		int x = env->agents[a].x;
+		int y = env->agents[a].y;
+		if (isInRoom(env, x, y)) {
+			env->occupancy[x][y] += 1;
+			env->agentMap[x][y] = (signed char)a;
+			boardPut(&env->occupied, x * MAX_ROOM_SIZE + y, TRUE);
+		}
+	}
+
+	env->numActive = 0;
+	for (int a = 0; a < env->numAgents; ++a) {
+		if (isInRoom(env, env->agents[a].x, env->agents[a].y)) {
+			env->active[env->numActive++] = a;
+		}
+	}
+}
+
+// move agent a to (x,y) and keep the occupancy up to date
+// (x,y) can also be (ESCAPED,ESCAPED) to take the agent out of the room
+void moveAgent(env *env, int a, int x, int y) {
+	int ox = env->agents[a].x;
+	int oy = env->agents[a].y;
+	env->agents[a].x = x;
+	env->agents[a].y = y;
+
+	if (isInRoom(env, ox, oy)) {
+		env->occupancy[ox][oy] -= 1;
+		if (env->occupancy[ox][oy] == 0) {
+			boardPut(&env->occupied, ox * MAX_ROOM_SIZE + oy, FALSE);
+		}
+		if (env->agentMap[ox][oy] == a) {
+			// dead agents stay where they died so other agents can
+			// end up on the same cell, in that case find who is left
+			env->agentMap[ox][oy] = NONE;
+			if (env->occupancy[ox][oy] > 0) {
+				for (int b = 0; b < env->numAgents; ++b) {
+					if (env->agents[b].x == ox && env->agents[b].y == oy) {
+						env->agentMap[ox][oy] = (signed char)b;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	if (isInRoom(env, x, y)) {
+		env->occupancy[x][y] += 1;
+		boardPut(&env->occupied, x * MAX_ROOM_SIZE + y, TRUE);
+		if (env->agentMap[x][y] == NONE || env->agentMap[x][y] > a) {
+			env->agentMap[x][y] = (signed char)a;
+		}
+	}
+}
+
+// free the Q-table of the learner
+void freeQTable(learner *learner) {
+	if (learner->tableAligned) {
+		free(learner->qMemory);
+	} else {
+		free(learner->qTable[0]);
+		free(learner->qTable[1]);
+	}
+	free(learner->qStamps);
+	free(learner->qBest);
+	learner->qTable[0] = NULL;
+	learner->qTable[1] = NULL;
+	learner->qStamps = NULL;
+	learner->qBest = NULL;
+	learner->qMemory = NULL;
+	learner->tableAligned = FALSE;
+
+	for (size_t b = 0; b < learner->numBlocks; ++b) {
+		free(learner->arena[b]);
+	}
+	free(learner->arena);
+	free(learner->hashKeys);
+	free(learner->hashEntries);
+	learner->arena = NULL;
+	learner->hashKeys = NULL;
+	learner->hashEntries = NULL;
+	learner->numBlocks = 0;
+	learner->numEntries = 0;
+	learner->hashCapacity = 0;
+}
+
+// TRUE if the learner has room for the second table of double Q
+bool hasSecondTable(const learner *learner) {
+	return learner->useSparseQ ?
+		learner->entrySize == 2 * learner->entryBytes :
+		learner->qTable[1] != NULL;
+}
+
+// how many bytes the 5 values of 1 state take up with the given precision
+int precisionBytes(precision p) {
+	switch (p) {
+		case PRECISION_FLOAT: return NUM_ACTIONS * sizeof(float);
+		case PRECISION_INT16: return NUM_ACTIONS * sizeof(int16_t);
+		case PRECISION_INT8:  return NUM_ACTIONS * sizeof(int8_t) + 1; // + the scale
+		default:              return NUM_ACTIONS * sizeof(double);
+	}
+}
+
+// round value to the nearest integer in [-limit,limit]
+long quantize(double value, long limit) {
+	double rounded = floor(value + 0.5);
+	return rounded > limit ? limit : rounded < -limit ? -limit : (long)rounded;
+}
+
+// get the Q-value for action a, from a Q-table with precision p - the
+// functions ending in With are the same as the ones without, but take the
+// precision as a parameter so the simulateTurn variants can make it constant
+static FORCE_INLINE double getQWith(const learner *learner, const qentry *q, action a, precision p) {
+	switch (p) {
+		case PRECISION_FLOAT: return ((const float *)q)[a];
+		case PRECISION_INT16: return ((const int16_t *)q)[a] / learner->fixedScale;
+		case PRECISION_INT8:  return ldexp(((const int8_t *)q)[a], ((const int8_t *)q)[NUM_ACTIONS]);
+		default:              return ((const double *)q)[a];
+	}
+}
+
+double getQ(const learner *learner, const qentry *q, action a) {
+	return getQWith(learner, q, a, learner->tablePrecision);
+}
+
+// get the Q-values for all 5 actions
+static FORCE_INLINE void getQsWith(const learner *learner, const qentry *q, double values[NUM_ACTIONS], precision p) {
+	for (action a = STAY; a <= UP; ++a) {
+		values[a] = getQWith(learner, q, a, p);
+	}
+}
+
+void getQs(const learner *learner, const qentry *q, double values[NUM_ACTIONS]) {
+	getQsWith(learner, q, values, learner->tablePrecision);
+}
+
+// set the Q-values for all 5 actions
+void setQs(const learner *learner, qentry *q, const double values[NUM_ACTIONS]) {
+	switch (learner->tablePrecision) {
+		case PRECISION_FLOAT: {
+			for (action a = STAY; a <= UP; ++a) {
+				((float *)q)[a] = (float)values[a];
+			}
+		} break;
+		case PRECISION_INT16: {
+			for (action a = STAY; a <= UP; ++a) {
+				((int16_t *)q)[a] = (int16_t)quantize(values[a] * learner->fixedScale, INT16_MAX);
+			}
+		} break;
+		case PRECISION_INT8: {
+			// all 5 values share a power of 2 scale which is stored after
+			// them, it is picked so that the largest value just fits
+			double largest = 0;
+			for (action a = STAY; a <= UP; ++a) {
+				largest = fmax(largest, fabs(values[a]));
+			}
+			int exponent = 0;
+			if (largest > 0) {
+				frexp(largest / INT8_MAX, &exponent);
+				exponent = clamp(exponent, INT8_MIN, INT8_MAX);
+			}
+			for (action a = STAY; a <= UP; ++a) {
+				((int8_t *)q)[a] = (int8_t)quantize(ldexp(values[a], -exponent), INT8_MAX);
+			}
+			((int8_t *)q)[NUM_ACTIONS] = (int8_t)exponent;
+		} break;
+		default: {
+			for (action a = STAY; a <= UP; ++a) {
+				((double *)q)[a] = values[a];
+			}
+		} break;
+	}
+}
+
+// set the Q-values for all 5 actions to the same value
+void fillQ(const learner *learner, qentry *q, double value) {
+	double values[NUM_ACTIONS];
+	for (action a = STAY; a <= UP; ++a) {
+		values[a] = value;
+	}
+	setQs(learner, q, values);
+}
+
+// move the Q-value for action a towards target, by the learning rate
+static FORCE_INLINE void updateQWith(const learner *learner, qentry *q, action a, double target, precision p) {
+	switch (p) {
+		case PRECISION_DOUBLE: {
+			double *values = (double *)q;
+			values[a] += learner->alpha * (target - values[a]);
+		} break;
+		case PRECISION_FLOAT: {
+			float *values = (float *)q;
+			values[a] = (float)(values[a] + learner->alpha * (target - values[a]));
+		} break;
+		case PRECISION_INT16: {
+			int16_t *values = (int16_t *)q;
+			double value = values[a] / learner->fixedScale;
+			value += learner->alpha * (target - value);
+			values[a] = (int16_t)quantize(value * learner->fixedScale, INT16_MAX);
+		} break;
+		case PRECISION_INT8: {
+			// changing 1 value can change the scale of all of them
+			double values[NUM_ACTIONS];
+			getQs(learner, q, values);
+			values[a] += learner->alpha * (target - values[a]);
+			setQs(learner, q, values);
+		} break;
+	}
+}
+
+// loop through all possible actions and find the best one:
+// if qB is NULL, the action with highest qA is returned
+// otherwise, the action with the highest average of qA and qB is returned
+static FORCE_INLINE action getBestActionWith(const learner *learner, const qentry *qEntryA, const qentry *qEntryB, precision p) {
+	// doubles can be used in place, everything else is converted first
+	double valuesA[NUM_ACTIONS], valuesB[NUM_ACTIONS];
+	const double *qA = (const double *)qEntryA;
+	const double *qB = (const double *)qEntryB;
+	if (p != PRECISION_DOUBLE) {
+		getQsWith(learner, qEntryA, valuesA, p);
+		qA = valuesA;
+		if (qEntryB != NULL) {
+			getQsWith(learner, qEntryB, valuesB, p);
+			qB = valuesB;
+		}
+	}
+
+	action maxa = STAY;
+	double maxq = -INFINITY;
+
+	for (action a = STAY; a <= UP; ++a) {
+		if (qA[a] + (qB ? qB[a] : 0) > maxq) {
+			maxq = qA[a] + (qB ? qB[a] : 0);
+			maxa = a;
+		}
+	}
+
+	return maxa;
+}
+
+action getBestAction(const learner *learner, const qentry *qEntryA, const qentry *qEntryB) {
+	return getBestActionWith(learner, qEntryA, qEntryB, learner->tablePrecision);
+}
+
+// the greedy action after the value (or sum of the values in both tables) of
+// action a changed from before, where best was the greedy action before
+// this gives the same action as getBestAction, ties go to the lowest action
+static FORCE_INLINE action newBestActionWith(const learner *learner, const qentry *qA, const qentry *qB, action best, action a, double before, precision p) {
+	double value = getQWith(learner, qA, a, p) + (qB ? getQWith(learner, qB, a, p) : 0);
+	if (a == best) {
+		// only if the best action got worse could another one be better now
+		return value < before ? getBestActionWith(learner, qA, qB, p) : best;
+	}
+	double bestValue = getQWith(learner, qA, best, p) + (qB ? getQWith(learner, qB, best, p) : 0);
+	return value > bestValue || (value == bestValue && a < best) ? a : best;
+}
+
+// look at all values of the state again to find its cached greedy actions
+// qA and qB are the entries for both tables of the state
+void refreshBest(learner *learner, int index, const qentry *qA, const qentry *qB) {
+	if (learner->qBest != NULL) {
+		unsigned char *best = learner->qBest[index];
+		best[BEST_A] = (unsigned char)getBestAction(learner, qA, NULL);
+		if (learner->bestDoubleQ && qB != NULL) {
+			best[BEST_B]  = (unsigned char)getBestAction(learner, qB, NULL);
+			best[BEST_AB] = (unsigned char)getBestAction(learner, qA, qB);
+		}
+	}
+}
+
+// the greedy action of the state with the given index, which is either BEST_A,
+// BEST_B or BEST_AB - this is only a lookup when the learner caches them
+// qA and qB are the entries for both tables of the state
+static FORCE_INLINE action getBestActionAtWith(const learner *learner, int index, int which, const qentry *qA, const qentry *qB, precision p) {
+	if (learner->qBest != NULL) {
+		return (action)learner->qBest[index][which];
+	}
+	switch (which) {
+		case BEST_B:  return getBestActionWith(learner, qB, NULL, p);
+		case BEST_AB: return getBestActionWith(learner, qA, qB, p);
+		default:      return getBestActionWith(learner, qA, NULL, p);
+	}
+}
+
+action getBestActionAt(const learner *learner, int index, int which, const qentry *qA, const qentry *qB) {
+	return getBestActionAtWith(learner, index, which, qA, qB, learner->tablePrecision);
+}
+
+// find the greedy actions of n states at once, where state i has the given
+// index and entries qA[i] and qB[i] - this gives the same actions as calling
+// getBestActionAt for each of them, but compares 2 states at a time
+void getBestActionsAt(const learner *learner, int n, int *indices, qentry **qA, qentry **qB, action *best) {
+	if (learner->qBest != NULL) {
+		for (int i = 0; i < n; ++i) {
+			best[i] = getBestActionAt(learner, indices[i], qB[i] ? BEST_AB : BEST_A, qA[i], qB[i]);
+		}
+		return;
+	}
+
+	// doubles can be used in place, everything else is converted first
+	// the rows are padded to an even number by repeating the last one
+	const double *rowsA[MAX_AGENTS + 1], *rowsB[MAX_AGENTS + 1];
+	double values[MAX_AGENTS][2][NUM_ACTIONS];
+	bool both = n > 0 && qB[0] != NULL;
+	for (int i = 0; i < n; ++i) {
+		if (learner->tablePrecision == PRECISION_DOUBLE) {
+			rowsA[i] = (const double *)qA[i];
+			rowsB[i] = (const double *)qB[i];
+		} else {
+			getQs(learner, qA[i], values[i][0]);
+			rowsA[i] = values[i][0];
+			rowsB[i] = NULL;
+			if (both) {
+				getQs(learner, qB[i], values[i][1]);
+				rowsB[i] = values[i][1];
+			}
+		}
+	}
+	if (n % 2 != 0) {
+		rowsA[n] = rowsA[n - 1];
+		rowsB[n] = rowsB[n - 1];
+	}
+
+	// like getBestAction, only strictly greater values replace the
+	// best one so far, which means ties go to the lowest action
+#ifdef USE_SSE2
+	for (int i = 0; i < n; i += 2) {
+		__m128d maxq = _mm_set1_pd(-INFINITY);
+		__m128d maxa = _mm_setzero_pd();
+		for (action a = STAY; a <= UP; ++a) {
+			__m128d q = _mm_set_pd(rowsA[i + 1][a], rowsA[i][a]);
+			if (both) {
+				q = _mm_add_pd(q, _mm_set_pd(rowsB[i + 1][a], rowsB[i][a]));
+			}
+			__m128d greater = _mm_cmpgt_pd(q, maxq);
+			maxq = _mm_or_pd(_mm_and_pd(greater, q), _mm_andnot_pd(greater, maxq));
+			maxa = _mm_or_pd(_mm_and_pd(greater, _mm_set1_pd(a)), _mm_andnot_pd(greater, maxa));
+		}
+		best[i] = (action)_mm_cvtsd_f64(maxa);
+		if (i + 1 < n) {
+			best[i + 1] = (action)_mm_cvtsd_f64(_mm_unpackhi_pd(maxa, maxa));
+		}
+	}
+#else
+	for (int i = 0; i < n; ++i) {
+		double maxq = -INFINITY;
+		best[i] = STAY;
+		for (action a = STAY; a <= UP; ++a) {
+			double q = rowsA[i][a] + (both ? rowsB[i][a] : 0);
+			if (q > maxq) {
+				maxq = q;
+				best[i] = a;
+			}
+		}
+	}
+#endif
+}
+
+// like updateQWith, for the first (0) or second (1) table of the state with the
+// given index, and keep the cached greedy actions of the state up to date
+// qA and qB are the entries for both tables of the state
+static FORCE_INLINE void learnQWith(learner *learner, int index, qentry *qA, qentry *qB, int table, action a, double target, precision p) {
+	qentry *q = table == 0 ? qA : qB;
+	double before = getQWith(learner, q, a, p);
+	updateQWith(learner, q, a, target, p);
+	if (learner->qBest == NULL) {
+		return;
+	}
+
+	unsigned char *best = learner->qBest[index];
+	if (p == PRECISION_INT8) {
+		// the other values might have changed with the shared scale
+		refreshBest(learner, index, qA, qB);
+		return;
+	}
+	best[table] = (unsigned char)newBestActionWith(learner, q, NULL, best[table], a, before, p);
+	if (learner->bestDoubleQ) {
+		double other = getQWith(learner, table == 0 ? qB : qA, a, p);
+		best[BEST_AB] = (unsigned char)newBestActionWith(learner, qA, qB, best[BEST_AB], a, before + other, p);
+	}
+}
+
+// where a state index goes in the hash map of the sparse backend
+size_t hashState(const learner *learner, uint32_t key) {
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+	return key & (learner->hashCapacity - 1);
+}
+
+// start loading the entries for the given state index into the cache, so
+// they are (hopefully) there by the time lookupQEntry needs them
+// the sparse backend only knows where the entries are after probing,
+// so there we can only load the first slot that gets probed
+void prefetchQEntry(const learner *learner, int index) {
+	if (!learner->useSparseQ) {
+		prefetch(&learner->qStamps[index]);
+		prefetch(learner->qTable[0] + (size_t)index * learner->rowBytes);
+		if (learner->qTable[1] != NULL && !learner->tableAligned) {
+			prefetch(learner->qTable[1] + (size_t)index * learner->rowBytes);
+		}
+	} else {
+		prefetch(&learner->hashKeys[hashState(learner, (uint32_t)index + 1)]);
+	}
+	if (learner->qBest != NULL) {
+		prefetch(learner->qBest[index]);
+	}
+}
+
+// find the entries for the given state index in the Q-tables, and if create
+// is TRUE, initialize them when they havent been seen since the last reset
+// - returns FALSE if the state isnt initialized (and create is FALSE)
+// *qA and *qB will point at the entry for the FIRST of FIVE actions,
+// *qB is NULL if there is no second table
+bool lookupQEntry(learner *learner, int index, bool create, qentry **qA, qentry **qB) {
+	// states that werent initialized start out at optimism, except before
+	// the very first reset, when the whole table is still all zeros
+	double initial = learner->qGeneration == 0 ? 0 : learner->optimism;
+	qentry *q0, *q1;
+
+	if (!learner->useSparseQ) {
+		q0 = (qentry *)(learner->qTable[0] + (size_t)index * learner->rowBytes);
+		q1 = learner->qTable[1] == NULL ? NULL :
+			(qentry *)(learner->qTable[1] + (size_t)index * learner->rowBytes);
+
+		// first time this state is seen since the last reset - initialize it
+		uint32_t *stamp = &learner->qStamps[index];
+		if (*stamp != learner->qGeneration) {
+			if (!create) {
+				return FALSE;
+			}
+			*stamp = learner->qGeneration;
+			fillQ(learner, q0, initial);
+			if (q1 != NULL) {
+				fillQ(learner, q1, initial);
+			}
+			if (learner->qBest != NULL) {
+				memset(learner->qBest[index], STAY, sizeof(learner->qBest[index]));
+			}
+		}
+	} else {
+		// linear probing, keys are the state index + 1 so that 0 is empty
+		uint32_t key = (uint32_t)index + 1;
+		size_t slot = hashState(learner, key);
+		while (learner->hashKeys[slot] != key && learner->hashKeys[slot] != 0) {
+			slot = (slot + 1) & (learner->hashCapacity - 1);
+		}
+
+		if (learner->hashKeys[slot] == 0) {
+			// first time this state is seen since the last reset - add it
+			if (!create) {
+				return FALSE;
+			}
+
+			// keep the map at most half full, by doubling it
+			// the entries themselves stay where they are
+			if (2 * (learner->numEntries + 1) > learner->hashCapacity) {
+				size_t oldCapacity = learner->hashCapacity;
+				uint32_t *oldKeys = learner->hashKeys;
+				uint32_t *oldEntries = learner->hashEntries;
+				learner->hashCapacity *= 2;
+				learner->hashKeys = calloc(learner->hashCapacity, sizeof(uint32_t));
+				learner->hashEntries = malloc(learner->hashCapacity * sizeof(uint32_t));
+				assert(learner->hashKeys && learner->hashEntries);
+				for (size_t i = 0; i < oldCapacity; ++i) {
+					if (oldKeys[i] != 0) {
+						size_t s = hashState(learner, oldKeys[i]);
+						while (learner->hashKeys[s] != 0) {
+							s = (s + 1) & (learner->hashCapacity - 1);
+						}
+						learner->hashKeys[s] = oldKeys[i];
+						learner->hashEntries[s] = oldEntries[i];
+					}
+				}
+				free(oldKeys);
+				free(oldEntries);
+
+				slot = hashState(learner, key);
+				while (learner->hashKeys[slot] != 0) {
+					slot = (slot + 1) & (learner->hashCapacity - 1);
+				}
+			}
+
+			// entries are handed out from fixed size blocks, so the
+			// pointers we return stay valid while the map grows
+			size_t entry = learner->numEntries++;
+			if (entry / ARENA_BLOCK >= learner->numBlocks) {
+				learner->arena = realloc(learner->arena, (learner->numBlocks + 1) * sizeof(*learner->arena));
+				assert(learner->arena);
+				learner->arena[learner->numBlocks] = malloc((size_t)ARENA_BLOCK * learner->entrySize);
+				assert(learner->arena[learner->numBlocks]);
+				++learner->numBlocks;
+			}
+			learner->hashKeys[slot] = key;
+			learner->hashEntries[slot] = (uint32_t)entry;
+
+
+			unsigned char *values = learner->arena[entry / ARENA_BLOCK] + (entry % ARENA_BLOCK) * learner->entrySize;
+			fillQ(learner, (qentry *)values, initial);
+			if (learner->entrySize == 2 * learner->entryBytes) {
+				fillQ(learner, (qentry *)(values + learner->entryBytes), initial);
+			}
+			if (learner->qBest != NULL) {
+				memset(learner->qBest[index], STAY, sizeof(learner->qBest[index]));
+			}
+		}
+
+		size_t entry = learner->hashEntries[slot];
+		unsigned char *values = learner->arena[entry / ARENA_BLOCK] + (entry % ARENA_BLOCK) * learner->entrySize;
+		q0 = (qentry *)values;
+		q1 = learner->entrySize == 2 * learner->entryBytes ? (qentry *)(values + learner->entryBytes) : NULL;
+	}
+
+	*qA = q0;
+	*qB = q1;
+	return TRUE;
+}
+
+// how many bytes the Q-table of the learner takes up
+size_t qTableMemory(const learner *learner) {
+	size_t cache = learner->qBest != NULL ? learner->numStates * sizeof(*learner->qBest) : 0;
+	if (!learner->useSparseQ) {
+		size_t planes = learner->tableAligned || learner->qTable[1] == NULL ? 1 : 2;
+		return cache + learner->numStates * (planes * learner->rowBytes + sizeof(uint32_t));
+	}
+	return cache +
+		learner->hashCapacity * 2 * sizeof(uint32_t) +
+		learner->numBlocks * (sizeof(*learner->arena) + (size_t)ARENA_BLOCK * learner->entrySize);
+}
+
+// how many states the Q-table of the learner has initialized since the last reset
+size_t qTableStates(const learner *learner) {
+	if (learner->useSparseQ) {
+		return learner->numEntries;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < learner->numStates; ++i) {
+		count += learner->qStamps[i] == learner->qGeneration;
+	}
+	return count;
+}
+
+// how many different vision states a cell can be in over an epoch, when
+// the epoch starts with the given cell there (use WALL outside the room)
+int visionRadix(char cell) {
+	switch (cell) {
+		case GLASS:   // DEACTIVATED, then SHARDS or an agent on the SHARDS
+		case DOOR:    // DEACTIVATED, then OPEN_DOOR or an agent in the door
+		case BANDAGE: // ACTIVATED, agent on the BANDAGE, then a FLOOR
+			return 3;
+		case WALL:    // always DEACTIVATED
+			return 1;
+		default:      // never changes, but an agent can stand on it
+			return 2;
+	}
+}
+
+// the cell the learners layout has at the given vision cell of (x,y)
+char layoutCell(const learner *learner, int x, int y, int vision) {
+	int cx = x + visionX[vision];
+	int cy = y + visionY[vision];
+	if (cx >= 0 && cx < learner->tableWidth && cy >= 0 && cy < learner->tableHeight) {
+		return learner->layout[cx][cy];
+	}
+	return WALL;
+}
+
+// find the index the given state of the old learner has in the new learner
+// or NONE if the state cant happen in the layout of the new learner
+int translateState(const learner *from, const learner *to, int x, int y, int hp, int vision) {
+	int pos = x * MAX_ROOM_SIZE + y;
+	int index = to->cellOffset[pos] + (hp - 1) * to->cellStates[pos];
+	for (int v = 0; v < 8; ++v) {
+		// decode the vision state from the old layout
+		int state = DEACTIVATED;
+		if (from->activeWeight[pos][v] != 0) {
+			state = (vision / from->activeWeight[pos][v]) % 3;
+		} else if (from->agentWeight[pos][v] != 0) {
+			state = (vision / from->agentWeight[pos][v]) % 2 ?
+				HAS_AGENT : cellVision[(unsigned char)layoutCell(from, x, y, v)];
+		}
+
+		// and encode it in the new one
+		if (to->activeWeight[pos][v] != 0) {
+			index += state * to->activeWeight[pos][v];
+		} else if (state == HAS_AGENT) {
+			if (to->agentWeight[pos][v] == 0) {
+				return NONE;
+			}
+			index += to->agentWeight[pos][v];
+		} else if (state != cellVision[(unsigned char)layoutCell(to, x, y, v)]) {
+			return NONE;
+		}
+	}
+	return index;
+}
+
+// make the Q-table of the learner fit the room of the environment, and
+// allocate the second table if double Q is on - entries for states that
+// can happen in both the old and the new room are kept, the others are lost
+// this also switches the Q-table to the backend the learner asks for
+// the memory of the dense table is only actually committed once touched
+// int16 values are in fixed point, with the largest power of 2 scale
+// that still fits twice the largest reward or initial value
+void fitFixedScale(learner *learner) {
+	double largest = 2 * fmax(1, fmax(fabs(learner->optimism),
+		fmax(fabs(learner->escapeReward), fabs(learner->deathPunishment))));
+	learner->fixedScale = 1;
+	while (largest * learner->fixedScale * 2 <= INT16_MAX) {
+		learner->fixedScale *= 2;
+	}
+	while (largest * learner->fixedScale > INT16_MAX) {
+		learner->fixedScale /= 2;
+	}
+}
+
+void allocQTable(learner *learner, env *env) {
+	// even if nothing is reallocated, double Q might have been switched
+	// off, and then the entries we looked up before are not the same
+	++learner->tableVersion;
+
+	// the table as it is now, which might not be in the backend asked for
+	struct learner old = *learner;
+	old.useSparseQ = learner->hashKeys != NULL;
+	bool hasTable = learner->hashKeys != NULL || learner->qTable[0] != NULL;
+	bool needsB = learner->useDoubleQ && !hasSecondTable(&old);
+	bool aligned = learner->useAlignedQ && !learner->useSparseQ;
+	// mid-epoch doors might be open and glass broken, so lay
+	// out the states for the room as it was when the epoch started
+	const char *room = env->currTurn > 0 ? env->backupRoom : &env->room[0][0];
+
+	bool cacheFits = learner->useBestCache ?
+		learner->qBest != NULL && learner->bestDoubleQ == learner->useDoubleQ :
+		learner->qBest == NULL;
+	if (hasTable && !needsB && old.useSparseQ == learner->useSparseQ && learner->tableAligned == aligned && cacheFits &&
+		learner->tablePrecision == learner->usePrecision &&
+		env->roomWidth == learner->tableWidth && env->roomHeight == learner->tableHeight &&
+		memcmp(room, learner->layout, sizeof(learner->layout)) == 0) {
+		return;
+	}
+
+	// the new learner is the same as the old one, just with a different table
+	struct learner fit = *learner;
+	fit.tableWidth = env->roomWidth;
+	fit.tableHeight = env->roomHeight;
+	memcpy(fit.layout, room, sizeof(fit.layout));
+
+	// lay out the states for every cell an agent can stand on - the states
+	// of each cell are indexed as [health - 1][vision 0]...[vision 7] but
+	// each vision only gets as many states as it can actually be in
+	size_t numStates = 0;
+	for (int x = 0; x < MAX_ROOM_SIZE; ++x) {
+		for (int y = 0; y < MAX_ROOM_SIZE; ++y) {
+			int pos = x * MAX_ROOM_SIZE + y;
+			memset(fit.agentWeight[pos], 0, sizeof(fit.agentWeight[pos]));
+			memset(fit.activeWeight[pos], 0, sizeof(fit.activeWeight[pos]));
+			fit.cellOffset[pos] = NONE;
+			fit.cellStates[pos] = 0;
+			if (x >= fit.tableWidth || y >= fit.tableHeight || fit.layout[x][y] == WALL) {
+				continue;
+			}
+
+			int place = 1;
+			for (int v = 7; v >= 0; --v) {
+				int radix = visionRadix(layoutCell(&fit, x, y, v));
+				fit.agentWeight[pos][v]  = (short)(radix == 3 ? 2 * place : radix == 2 ? place : 0);
+				fit.activeWeight[pos][v] = (short)(radix == 3 ? place : 0);
+				place *= radix;
+			}
+			fit.cellOffset[pos] = (int)numStates;
+			fit.cellStates[pos] = place;
+			numStates += MAX_HEALTH * place;
+		}
+	}
+	fit.numStates = numStates;
+
+	fit.tablePrecision = fit.usePrecision;
+	fit.entryBytes = precisionBytes(fit.tablePrecision);
+	fitFixedScale(&fit);
+
+	bool withB = learner->useDoubleQ || hasSecondTable(&old);
+	fit.qTable[0] = NULL;
+	fit.qTable[1] = NULL;
+	fit.qStamps = NULL;
+	fit.qMemory = NULL;
+	fit.tableAligned = aligned;
+	fit.bestDoubleQ = fit.useDoubleQ;
+	fit.qBest = NULL;
+	if (fit.useBestCache) {
+		fit.qBest = calloc(numStates, sizeof(*fit.qBest));
+		assert(fit.qBest);
+	}
+	fit.arena = NULL;
+	fit.numBlocks = 0;
+	fit.numEntries = 0;
+	if (aligned) {
+		// 40 bytes per state become 64, 2 * 40 become 128 etc.
+		fit.rowBytes = 1;
+		while (fit.rowBytes < (size_t)(withB ? 2 : 1) * fit.entryBytes) {
+			fit.rowBytes *= 2;
+		}
+		fit.qMemory = calloc(numStates * fit.rowBytes + 63, 1);
+		fit.qStamps = calloc(numStates, sizeof(uint32_t));
+		assert(fit.qMemory && fit.qStamps);
+		fit.qTable[0] = (unsigned char *)(((uintptr_t)fit.qMemory + 63) & ~(uintptr_t)63);
+		if (withB) {
+			fit.qTable[1] = fit.qTable[0] + fit.entryBytes;
+		}
+		fit.hashKeys = NULL;
+		fit.hashEntries = NULL;
+		fit.hashCapacity = 0;
+	} else if (!fit.useSparseQ) {
+		fit.rowBytes = fit.entryBytes;
+		fit.qTable[0] = calloc(numStates, fit.entryBytes);
+		fit.qStamps = calloc(numStates, sizeof(uint32_t));
+		assert(fit.qTable[0] && fit.qStamps);
+		if (withB) {
+			fit.qTable[1] = calloc(numStates, fit.entryBytes);
+			assert(fit.qTable[1]);
+		}
+		fit.hashKeys = NULL;
+		fit.hashEntries = NULL;
+		fit.hashCapacity = 0;
+	} else {
+		fit.entrySize = withB ? 2 * fit.entryBytes : fit.entryBytes;
+		fit.hashCapacity = 1024;
+		fit.hashKeys = calloc(fit.hashCapacity, sizeof(uint32_t));
+		fit.hashEntries = malloc(fit.hashCapacity * sizeof(uint32_t));
+		assert(fit.hashKeys && fit.hashEntries);
+	}
+
+	// copy over all the states that were initialized in this generation
+	// and can still happen (everything else reads as not initialized)
+	if (hasTable) {
+		for (int x = 0; x < MAX_ROOM_SIZE; ++x) {
+			for (int y = 0; y < MAX_ROOM_SIZE; ++y) {
+				int pos = x * MAX_ROOM_SIZE + y;
+				if (old.cellOffset[pos] == NONE || fit.cellOffset[pos] == NONE) {
+					continue;
+				}
+				for (int hp = 1; hp <= MAX_HEALTH; ++hp) {
+					for (int vision = 0; vision < old.cellStates[pos]; ++vision) {
+						int from = old.cellOffset[pos] + (hp - 1) * old.cellStates[pos] + vision;
+						qentry *fromA, *fromB, *toA, *toB;
+						if (!lookupQEntry(&old, from, FALSE, &fromA, &fromB)) {
+							continue;
+						}
+						int to = translateState(&old, &fit, x, y, hp, vision);
+						if (to == NONE) {
+							continue;
+						}
+
+						// a new second table starts out the same as the first one did
+						// going through doubles also converts between precisions
+						double values[NUM_ACTIONS];
+						lookupQEntry(&fit, to, TRUE, &toA, &toB);
+						getQs(&old, fromA, values);
+						setQs(&fit, toA, values);
+						if (toB != NULL && fromB != NULL) {
+							getQs(&old, fromB, values);
+							setQs(&fit, toB, values);
+						}
+						refreshBest(&fit, to, toA, toB);
+					}
+				}
+			}
+		}
+	}
+
+	freeQTable(learner);
+	*learner = fit;
+}
+
+// load all Q-table with an initial value
+// this takes constant time, the entries are actually
+// initialized lazily by getQEntry when first looked up
+void loadQTable(learner *learner, double initialValues) {
+	learner->optimism = initialValues;
+	// no entry is kept, so the int16 scale can just change with the value
+	fitFixedScale(learner);
+	++learner->tableVersion;
+	if (++learner->qGeneration == 0) {
+		// the generation counter wrapped around, so old stamps
+		// could look valid again - clear them all just this once
+		if (learner->qStamps != NULL) {
+			memset(learner->qStamps, 0, learner->numStates * sizeof(uint32_t));
+		}
+		learner->qGeneration = 1;
+	}
+
+	// the sparse backend just forgets all of its states, but keeps its memory
+	if (learner->useSparseQ && learner->hashKeys != NULL) {
+		memset(learner->hashKeys, 0, learner->hashCapacity * sizeof(uint32_t));
+		learner->numEntries = 0;
+	}
+}
+
+// call this after the size of the room changed, this starts a new epoch
+// so that the Q-table and the backups are always for the same room
+void roomResized(env *env) {
+	env->currTurn = 0;
+	env->totalReward = 0;
+	env->numEscaped = 0;
+	memcpy(env->backupRoom, env->room, sizeof(env->backupRoom));
+	memcpy(env->backupAgents, env->agents, sizeof(env->backupAgents));
+	updateNeighbours(env);
+	updateBoards(env);
+	allocQTable(env->learner, env);
+}
+
 // load room configuration from given file
 // or load empty 9x9 room in case of error
-void loadRoom(const char *filename) {
+void loadRoom(env *env, const char *filename) {
 	printf("loading %s ... ", filename);
 	FILE *roomFile = fopen(filename, "rt");
 	if (roomFile != NULL) {
-		roomWidth = 0;
-		roomHeight = 0;
-		numAgents = 0;
+		env->roomWidth = 0;
+		env->roomHeight = 0;
+		env->numAgents = 0;
 		int c, x = 0, y = 0;
 		do {
 			c = getc(roomFile);
 			if (c == '\n' || c == '\r' || c == EOF) {
 				if (x > 0) {
 					// start new row
-					if (roomWidth == 0) {
-						roomWidth = x;
+					if (env->roomWidth == 0) {
+						env->roomWidth = x;
 					}
 
-					if (x != roomWidth) {
+					if (x != env->roomWidth) {
 						printf("inconsistent room dimensions\n");
 						goto makeDefaultRoom;
 					} else if (y >= MAX_ROOM_SIZE){
@@ -211,7 +1561,7 @@ void loadRoom(const char *filename) {
 				}
 			} else {
 				// add new column
-				if (roomWidth > 0 && x >= roomWidth) {
+				if (env->roomWidth > 0 && x >= env->roomWidth) {
 					printf("inconsistent room dimensions\n");
 					goto makeDefaultRoom;
 				} else if (x >= MAX_ROOM_SIZE) {
@@ -221,46 +1571,46 @@ void loadRoom(const char *filename) {
 
 				if (c == AGENT) {
 					// add new agent
-					if (numAgents < MAX_AGENTS) {
-						room[x][y] = FLOOR;
-						agents[numAgents].health = 2;
-						agents[numAgents].x = x;
-						agents[numAgents].y = y;
-						++numAgents;
+					if (env->numAgents < MAX_AGENTS) {
+						env->room[x][y] = FLOOR;
+						env->agents[env->numAgents].health = 2;
+						env->agents[env->numAgents].x = x;
+						env->agents[env->numAgents].y = y;
+						++env->numAgents;
 					} else {
 						printf("too many agents specified\n");
 						goto makeDefaultRoom;
 					}
 				} else {
 					// add new cell
-					room[x][y] = (char)c;
+					env->room[x][y] = (char)c;
 				}
 
 				++x;
 			}
 		} while (c != EOF);
 
-		roomHeight = y;
-		if (roomWidth < 1 || roomWidth > MAX_ROOM_SIZE) {
+		env->roomHeight = y;
+		if (env->roomWidth < 1 || env->roomWidth > MAX_ROOM_SIZE) {
 			printf("room too wide\n");
 			goto makeDefaultRoom;
-		} else if (roomHeight < 1 || roomHeight > MAX_ROOM_SIZE) {
+		} else if (env->roomHeight < 1 || env->roomHeight > MAX_ROOM_SIZE) {
 			printf("room too tall\n");
 			goto makeDefaultRoom;
 		}
 
 		// flip room horizontally since we read it in backwards
-		for (x = 0; x < roomWidth; ++x) {
-			for (y = 0; y < roomHeight / 2; ++y) {
-				char temp = room[x][y];
-				room[x][y] = room[x][roomHeight - y - 1];
-				room[x][roomHeight - y - 1] = temp;
+		for (x = 0; x < env->roomWidth; ++x) {
+			for (y = 0; y < env->roomHeight / 2; ++y) {
+				char temp = env->room[x][y];
+				env->room[x][y] = env->room[x][env->roomHeight - y - 1];
+				env->room[x][env->roomHeight - y - 1] = temp;
 			}
 		}
 
 		// also flip all the agents
-		for (int agent = 0; agent < numAgents; ++agent) {
-			agents[agent].y = roomHeight - agents[agent].y - 1;
+		for (int agent = 0; agent < env->numAgents; ++agent) {
+			env->agents[agent].y = env->roomHeight - env->agents[agent].y - 1;
 		}
 
 		printf("done\n");
@@ -268,12 +1618,12 @@ void loadRoom(const char *filename) {
 		printf("file not found\n");
 
 	makeDefaultRoom:
-		numAgents = 0;
-		roomWidth = 9;
-		roomHeight = 9;
-		for (int x = 0; x < roomWidth; ++x) {
-			for (int y = 0; y < roomHeight; ++y) {
-				room[x][y] = FLOOR;
+		env->numAgents = 0;
+		env->roomWidth = 9;
+		env->roomHeight = 9;
+		for (int x = 0; x < env->roomWidth; ++x) {
+			for (int y = 0; y < env->roomHeight; ++y) {
+				env->room[x][y] = FLOOR;
 			}
 		}
 
@@ -283,368 +1633,585 @@ void loadRoom(const char *filename) {
 	if (roomFile != NULL) {
 		fclose(roomFile);
 	}
-}
 
-// load all Q-table with an initial value
-void loadQTable(double initialValues) {
-	optimism = initialValues;
-	double *q = &qTable[0][0][0][0][0][0][0][0][0][0][0][0][0];
-	double numEntries = sizeof(qTable) / sizeof(*q);
-	for (int i = 0; i < numEntries; ++i) {
-		q[i] = optimism;
-	}
+	roomResized(env);
+	updateOccupancy(env);
 }
 
 // open a file to which results from every epoch will be stored
 // note that the entire file will be cleared
-void openResultsFile(const char *filename) {
-	if (resultsFile != NULL) {
-		fclose(resultsFile);
+void openResultsFile(env *env, const char *filename) {
+	if (env->resultsFile != NULL) {
+		fclose(env->resultsFile);
 	}
 
-	resultsFile = fopen(filename, "r");
-	if (resultsFile == NULL) {
+	env->resultsFile = fopen(filename, "r");
+	if (env->resultsFile == NULL) {
 		printf("creating %s ... ", filename);
 	} else {
-		fclose(resultsFile);
+		fclose(env->resultsFile);
 		printf("clearing %s ... ", filename);
 	}
 
-	resultsFile = fopen(filename, "wt");
-	if (resultsFile != NULL) {
-		fprintf(resultsFile, "epoch, total reward\n");
-		printf("done\n");
-	} else {
-		printf("couldn't open file\n");
+	env->resultsFile = fopen(filename, "wt");
+	if (env->resultsFile != NULL) {
+		fprintf(env->resultsFile, "epoch, total reward\n");
+		printf("done\n");
+	} else {
+		printf("couldn't open file\n");
+	}
+}
+
+// get the index of a state in the Q-table (ignoring the 2 tables and the 5
+// actions), for an agent at (x,y) with the given health that sees the agents
+// on the occupied board - see allocQTable for how the states are laid out
+int getStateIndex(env *env, const board *occupied, int x, int y, int hp) {
+	assert(hp > 0 && hp <= MAX_HEALTH);
+	assert(isInRoom(env, x, y));
+	assert(x < env->learner->tableWidth && y < env->learner->tableHeight);
+
+	const learner *learner = env->learner;
+	int pos = x * MAX_ROOM_SIZE + y;
+	assert(learner->cellOffset[pos] != NONE);
+	int index = learner->cellOffset[pos] + (hp - 1) * learner->cellStates[pos];
+
+	// each visible cell is either DEACTIVATED, ACTIVATED, or HAS_AGENT
+	// the visible cells were precomputed by updateNeighbours, and cells
+	// outside of the room all point at a cell that is in no board
+	const unsigned char *visible = env->neighbours[pos];
+
+#ifdef USE_SSE2
+	// gather the 8 visible cells as 16-bit lanes and take their
+	// dot product with the weights of the layout all at once
+	short hasAgent[8], isActive[8];
+	for (int vision = 0; vision < 8; ++vision) {
+		int cell = visible[vision];
+		int agent     = (int)((occupied->bits[cell >> 6]       >> (cell & 63)) & 1);
+		int activated = (int)((env->activated.bits[cell >> 6] >> (cell & 63)) & 1);
+		hasAgent[vision] = (short)agent;
+		isActive[vision] = (short)(activated & ~agent); // HAS_AGENT overrides ACTIVATED
+	}
+	__m128i sum = _mm_add_epi32(
+		_mm_madd_epi16(_mm_loadu_si128((const __m128i *)hasAgent),
+			_mm_loadu_si128((const __m128i *)learner->agentWeight[pos])),
+		_mm_madd_epi16(_mm_loadu_si128((const __m128i *)isActive),
+			_mm_loadu_si128((const __m128i *)learner->activeWeight[pos])));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return index + _mm_cvtsi128_si32(sum);
+#else
+	for (int vision = 0; vision < 8; ++vision) {
+		int cell = visible[vision];
+		int agent     = (int)((occupied->bits[cell >> 6]       >> (cell & 63)) & 1);
+		int activated = (int)((env->activated.bits[cell >> 6] >> (cell & 63)) & 1);
+		index += agent * learner->agentWeight[pos][vision];
+		index += (activated & ~agent) * learner->activeWeight[pos][vision]; // HAS_AGENT overrides ACTIVATED
+	}
+	return index;
+#endif
+}
+
+// compute the state index of every agent that is alive and in the room in a
+// single pass, all other agents get NONE - if afterAct is TRUE this is the
+// state each agent will be in once simulateTurn hands out its reward: agents
+// on SHARDS lose health (and dying ones get NONE), agents on a BANDAGE heal,
+// agents on the EXIT get NONE, and they disappear from the view of all the
+// agents after them, exactly like they would if we looked up one at a time
+void getStateIndices(env *env, bool afterAct, int *indices) {
+	board occupied = env->occupied;
+	for (int i = 0; i < env->numActive; ++i) {
+		int a  = env->active[i];
+		int x  = env->agents[a].x;
+		int y  = env->agents[a].y;
+		int hp = env->agents[a].health;
+		indices[a] = NONE;
+		if (!isInRoom(env, x, y) || hp <= 0) {
+			continue;
+		}
+
+		int cell = x * MAX_ROOM_SIZE + y;
+		if (afterAct) {
+			if (boardHas(&env->exit, cell)) {
+				boardPut(&occupied, cell, FALSE); // only 1 living agent fits on a cell
+				continue;
+			} else if (boardHas(&env->shards, cell)) {
+				hp -= 1;
+			} else if (boardHas(&env->bandage, cell)) {
+				hp = MAX_HEALTH;
+			}
+		}
+
+		if (hp > 0) {
+			indices[a] = getStateIndex(env, &occupied, x, y, hp);
+		}
 	}
 }
 
-// get the Q-table entries for both Q-tables for the given
-// agent and using the current state (room and agents)
+// get the Q-table entries for both Q-tables for the given state index
 // *qA and *qB will point into the position of the entry for
 // the FIRST of FIVE actions the agent can take in this state
-void getQEntry(int agent, double **qA, double **qB) {
-	assert(agents[agent].health > 0 && agents[agent].health <= MAX_HEALTH);
-	assert(isInRoom(agents[agent].x, agents[agent].y));
-
-	int x  = agents[agent].x;
-	int y  = agents[agent].y;
-	int hp = agents[agent].health;
-
-	// the agents can see cells around them in a crosshair:
-	//       [ ]
-	//       [ ]
-	// [ ][ ] @ [ ][ ]
-	//       [ ]
-	//       [ ]
-	// the arrays below store corrdinate offsets of the visible cells
-	const int xOffsets[] = { -2, -1, 1, 2,  0,  0, 0, 0 };
-	const int yOffsets[] = {  0,  0, 0, 0, -2, -1, 1, 2 };
-
-	// each visible cell can be either:
-	enum {
-		DEACTIVATED, // e.g. FLOOR (static) or DOOR (dynamic)
-		ACTIVATED,   // OPEN_DOOR, BROKEN_GLASS, and BANDAGE
-		HAS_AGENT    // overrides all other cell states above
-	} state[8];
-
-	// we need to check for all visible cells if they contain an agent
-	// but agentAt loops over all agents - by precomputing which cells
-	// have an agent we can avoid O(N^2) performance
-	// we REALLY should have done this globally for maximum performance
-	// but that would have made everything too complicated
-	assert(MAX_ROOM_SIZE < 8 * sizeof(int));
-	int occupancy[MAX_ROOM_SIZE];
-	memset(occupancy, 0, sizeof(occupancy));
-	for (int a = 0; a < numAgents; ++a) {
-		if (isInRoom(agents[a].x, agents[a].y)) {
-			occupancy[agents[a].x] |= (1 << (agents[a].y));
-		}
-	}
-
-	// loop over visible cells
-	for (int vision = 0; vision < 8; ++vision) {
-		int cx = x + xOffsets[vision];
-		int cy = y + yOffsets[vision];
+void getQEntryAt(learner *learner, int index, qentry **qA, qentry **qB) {
+	qentry *q1;
+	lookupQEntry(learner, index, TRUE, qA, &q1);
+	assert(q1 != NULL || !learner->useDoubleQ);
+	*qB = !learner->useDoubleQ ? NULL : q1;
+}
 
-		if (isInRoom(cx, cy)) {
-			if (occupancy[cx] & (1 << cy)) {
-				state[vision] = HAS_AGENT;
-			} else {
-				state[vision] =
-					room[cx][cy] == SHARDS    ? ACTIVATED :
-					room[cx][cy] == OPEN_DOOR ? ACTIVATED :
-					room[cx][cy] == BANDAGE   ? ACTIVATED :
-					DEACTIVATED;
-			}
-		} else {
-			state[vision] = DEACTIVATED;
-		}
+// like getQEntryAt, but never initializes the entries - returns FALSE
+// if the state wasnt visited since the last reset (see lookupQEntry)
+bool findQEntryAt(learner *learner, int index, qentry **qA, qentry **qB) {
+	qentry *q1;
+	if (!lookupQEntry(learner, index, FALSE, qA, &q1)) {
+		return FALSE;
 	}
+	*qB = !learner->useDoubleQ ? NULL : q1;
+	return TRUE;
+}
 
-	*qA =
-		qTable[0][x][y][hp - 1]
-		[state[0]][state[1]][state[2]][state[3]]
-		[state[4]][state[5]][state[6]][state[7]];
-	*qB = !useDoubleQ ? NULL :
-		qTable[1][x][y][hp - 1]
-		[state[0]][state[1]][state[2]][state[3]]
-		[state[4]][state[5]][state[6]][state[7]];
+// get the Q-table entries for both Q-tables for the given
+// agent and using the current state (room and agents)
+void getQEntry(env *env, int agent, qentry **qA, qentry **qB) {
+	int index = getStateIndex(env, &env->occupied,
+		env->agents[agent].x, env->agents[agent].y, env->agents[agent].health);
+	getQEntryAt(env->learner, index, qA, qB);
 }
 
-// loop through all possible actions and find the best one:
-// if qB is NULL, the action with highest qA is returned
-// otherwise, the action with the highest average of qA and qB is returned
-action getBestAction(double *qA, double *qB) {
-	action maxa = STAY;
-	double maxq = -INFINITY;
+// resolve collisions between n agents without depending on their order, the
+// agent i wants to move from the cell from[i] to the cell to[i] - every agent
+// claims the cell it wants to move to, and as long as a cell is claimed by
+// more than 1 agent, the agents moving onto it are all bumped back and claim
+// the cell they came from instead, which is then where to[i] ends up
+void resolveClaims(int n, unsigned char *from, unsigned char *to) {
+	unsigned char claims[MAX_CELLS];
+	memset(claims, 0, sizeof(claims));
+	for (int i = 0; i < n; ++i) {
+		claims[to[i]] += 1;
+	}
 
-	for (action a = STAY; a <= UP; ++a) {
-		if (qA[a] + (qB ? qB[a] : 0) > maxq) {
-			maxq = qA[a] + (qB ? qB[a] : 0);
-			maxa = a;
+	// every agent is bumped at most once, so this takes at most n rounds
+	bool bumped;
+	do {
+		bool bump[MAX_AGENTS];
+		bumped = FALSE;
+		for (int i = 0; i < n; ++i) {
+			bump[i] = to[i] != from[i] && claims[to[i]] > 1;
+			bumped |= bump[i];
+		}
+		for (int i = 0; i < n; ++i) {
+			if (bump[i]) {
+				claims[to[i]]   -= 1;
+				claims[from[i]] += 1;
+				to[i] = from[i];
+			}
 		}
+	} while (bumped);
+}
+
+// remember how the next turn starts, and return TRUE if one of the last
+// CYCLE_WINDOW turns of the epoch started exactly the same way, and the
+// Q-table didnt change since then - see env.skipCycles
+bool findCycle(env *env) {
+	const learner *learner = env->learner;
+	uint16_t agents[MAX_AGENTS];
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	for (int i = 0; i < env->numActive; ++i) {
+		const agent *agent = &env->agents[env->active[i]];
+		agents[i] = (uint16_t)((agent->x * MAX_ROOM_SIZE + agent->y) * (MAX_HEALTH + 1) + agent->health);
+		hash = (hash ^ agents[i]) * 1099511628211ULL;
 	}
 
-	return maxa;
-}
+	// the turns only repeat if the agents learn the same way as before
+	double params[5] = {
+		learner->alpha, learner->gamma,
+		learner->escapeReward, learner->deathPunishment, learner->idlePunishment,
+	};
+	uint64_t bits[5];
+	memcpy(bits, params, sizeof(bits));
+	for (int i = 0; i < 5; ++i) {
+		hash = (hash ^ bits[i]) * 1099511628211ULL;
+	}
 
-// modify (*x,*y) according to the given action
-void actionModCoords(action a, int *x, int *y) {
-	switch (a) {
-		case LEFT:	*x -= 1; break;
-		case RIGHT: *x += 1; break;
-		case DOWN:	*y -= 1; break;
-		case UP:	*y += 1; break;
-		default: /* STAY */ break;
+	int turn = env->currTurn + 1;
+	bool found = FALSE;
+	for (int period = 1; period <= env->stableTurns && period <= CYCLE_WINDOW && !found; ++period) {
+		const int slot = (turn - period) % CYCLE_WINDOW;
+		found =
+			env->pastTurns[slot].epoch == env->currEpoch &&
+			env->pastTurns[slot].turn == turn - period &&
+			env->pastTurns[slot].hash == hash &&
+			env->pastTurns[slot].changes == env->changes &&
+			env->pastTurns[slot].numActive == env->numActive &&
+			memcmp(env->pastTurns[slot].agents, agents, env->numActive * sizeof(*agents)) == 0;
 	}
 
-	*x = clamp(*x, 0, roomWidth  - 1);
-	*y = clamp(*y, 0, roomHeight - 1);
+	const int slot = turn % CYCLE_WINDOW;
+	env->pastTurns[slot].epoch = env->currEpoch;
+	env->pastTurns[slot].turn = turn;
+	env->pastTurns[slot].changes = env->changes;
+	env->pastTurns[slot].numActive = env->numActive;
+	env->pastTurns[slot].hash = hash;
+	memcpy(env->pastTurns[slot].agents, agents, env->numActive * sizeof(*agents));
+	return found;
 }
 
 // simulate an entire turn of agents escaping
 // return TRUE if an epoch has passed after the rurn
 // this is where the interesting stuff is!
-bool simulateTurn() {
-	if (currTurn == 0) {
+// useDoubleQ, useEpsilon and p have to be the same as in the learner, they
+// are parameters so that simulateTurn can use a copy of this where they are
+// constants, which doesnt have to check them for every agent
+static FORCE_INLINE bool simulateTurnWith(env *env, const bool useDoubleQ, const bool useEpsilon, const precision p) {
+	if (env->currTurn == 0) {
 		// make a backup of the room before changing anything!
-		memcpy(backupRoom, room, sizeof(room));
-		memcpy(backupAgents, agents, sizeof(agents));
+		memcpy(env->backupRoom, env->room, sizeof(env->backupRoom));
+		memcpy(env->backupAgents, env->agents, sizeof(env->backupAgents));
 	}
 
 	// various things about the agent's decision is stored here
 	struct actionrecord {
-		bool isEscaping; // is the agent alive and not escaped yet?
 		int x, y;        // position before moving
 		int dx, dy;      // position to which the agent wants to move
 		action action;   // action that the agent picked
-		double *q0, *q1; // pointers into the Q-table for the state before any action is taken
+		int state;       // index of the state before any action is taken
+		qentry *q0, *q1; // pointers into the Q-table for that state
 	} actionRecords[MAX_AGENTS];
 
 	// when checking for collisions we will frequently want to know which agent
 	// wants to move where - rather than looping through all the agents we use a
 	// map which stores at each (x,y) which agent wants to move there (or NONE)
 	int collisionMap[MAX_ROOM_SIZE][MAX_ROOM_SIZE];
-	bool someAgentsAreEscaping = FALSE; // if everybody escapes we can immediately start the next epoch
 
-	memset(actionRecords, 0, sizeof(actionRecords));
-	memset(collisionMap, NONE, sizeof(collisionMap)); // this DOES work because NONE == -1 == 0xFFF..
+	// look up the state of every agent at once, and start loading the
+	// entries of the states that werent looked up last turn already
+	int states[MAX_AGENTS];
+	getStateIndices(env, FALSE, states);
+	for (int i = 0; i < env->numActive; ++i) {
+		int a = env->active[i];
+		bool looked = env->lastVersion == env->learner->tableVersion && env->lastEntries[a].state == states[a];
+		if (states[a] != NONE && !looked) {
+			prefetchQEntry(env->learner, states[a]);
+		}
+	}
+
+	// decide on an action for each agent - the random numbers are drawn in
+	// the same order as if each agent decided on its own, but the greedy
+	// actions are only found afterwards, for all the agents at once
+	uint64_t explore = randThreshold(env->learner->epsilon);
+	int numGreedy = 0;
+	int greedyAgents[MAX_AGENTS], greedyStates[MAX_AGENTS];
+	qentry *greedyA[MAX_AGENTS], *greedyB[MAX_AGENTS];
+	int numActive = 0;
+	for (int i = 0; i < env->numActive; ++i) {
+		int a = env->active[i];
+		if (env->agents[a].health <= 0) {
+			continue; // dead agents stay in the room, but never act again
+		}
+		env->active[numActive++] = a;
 
-	// decide action and resolve collisions for each agent
-	for (int a = 0; a < numAgents; ++a) {
 		// initialize the record
-		int x = agents[a].x;
-		int y = agents[a].y;
+		int x = env->agents[a].x;
+		int y = env->agents[a].y;
 		struct actionrecord *record = &actionRecords[a];
 		record->x = x;
 		record->y = y;
 		record->dx = x;
 		record->dy = y;
-		if (isInRoom(x, y)) {
-			if (agents[a].health > 0) {
-				record->isEscaping    = TRUE;
-				someAgentsAreEscaping = TRUE;
-
-				// get action based on policy
-				double *q0, *q1;
-				getQEntry(a, &q0, &q1);
-				action act;
-				if (useEpsilon && randf(&globalRNG) < epsilon) {
-					act = randAction(&globalRNG); // epsilon
-				} else {
-					act = getBestAction(q0, q1);  // greedy
-				}
 
-				// store Q-entries so we can update them later
-				actionRecords[a].q0 = q0;
-				actionRecords[a].q1 = q1;
-				actionRecords[a].action = act;
+		// get action based on policy
+		qentry *q0, *q1;
+		if (env->lastVersion == env->learner->tableVersion && env->lastEntries[a].state == states[a]) {
+			q0 = env->lastEntries[a].q0;
+			q1 = env->lastEntries[a].q1;
+		} else if (!env->readOnly) {
+			getQEntryAt(env->learner, states[a], &q0, &q1);
+		} else if (!findQEntryAt(env->learner, states[a], &q0, &q1)) {
+			q0 = q1 = NULL;
+		}
+		if (useEpsilon && agentRand(env, a) < explore) {
+			record->action = randActionFrom(agentRand(env, a)); // epsilon
+		} else if (q0 == NULL) {
+			// a state that wasnt visited has the same value for every action
+			record->action = STAY;
+		} else {
+			// greedy
+			greedyAgents[numGreedy] = a;
+			greedyStates[numGreedy] = states[a];
+			greedyA[numGreedy] = q0;
+			greedyB[numGreedy] = q1;
+			++numGreedy;
+		}
 
-				actionModCoords(act, &x, &y);
-				if (isPassable(room[x][y])) {
-					// agent can move here
-					record->dx = x;
-					record->dy = y;
-				} else {
-					// agent can't move here
-					x = record->x;
-					y = record->y;
-				}
+		// store Q-entries so we can update them later
+		record->state = states[a];
+		record->q0 = q0;
+		record->q1 = q1;
+	}
+	env->numActive = numActive;
+	bool someAgentsAreEscaping = numActive > 0; // if everybody escapes we can immediately start the next epoch
 
-				// resolve collisions with other agents by looking up
-				// the collision map - agents that collide stay in place
-				int b = collisionMap[x][y];
-				if (b != NONE) {
-					// collision a->b !
-					// 1. stop b from moving
-					// 2. stop a from moving
-					do {
-						// 1.1. b moves to where it started the turn
-						struct actionrecord *brec = &actionRecords[b];
-						brec->dx = brec->x;
-						brec->dy = brec->y;
-
-						// 1.2. check for new collisions b'->b
-						int next = collisionMap[brec->x][brec->y];
-						collisionMap[brec->x][brec->y] = b;
-						if (next == b) { // if b chose to STAY the chain is broken
-							next = NONE;
-						}
-						b = next; // continue running down the collision chain
-					} while (b != NONE);
-
-					// 2.1. a moves to where it started the turn
-					x = record->x;
-					y = record->y;
-					record->dx = x;
-					record->dy = y;
-
-					// 2.2. check for new collisions with a
-					int c = collisionMap[x][y];
-					while (c != NONE) {
-						// collision c->a !
-						// 2.3. c moves to where it started the turn
-						struct actionrecord *crec = &actionRecords[c];
-						crec->dx = crec->x;
-						crec->dy = crec->y;
-						// 2.4. check for new collisions c'->c
-						int next = collisionMap[crec->x][crec->y];
-						collisionMap[crec->x][crec->y] = c;
-						if (next == c) {
-							next = NONE;
-						}
-						c = next; // continue running down the collision chain
+	action greedyActions[MAX_AGENTS];
+	getBestActionsAt(env->learner, numGreedy, greedyStates, greedyA, greedyB, greedyActions);
+	for (int i = 0; i < numGreedy; ++i) {
+		actionRecords[greedyAgents[i]].action = greedyActions[i];
+	}
+
+	// resolve collisions between the agents, either all at once
+	// by their claims or 1 agent at a time (see env.bumpMode)
+	if (env->bumpMode == BUMP_CLAIMS) {
+		unsigned char from[MAX_AGENTS], to[MAX_AGENTS];
+		for (int i = 0; i < env->numActive; ++i) {
+			struct actionrecord *record = &actionRecords[env->active[i]];
+			from[i] = (unsigned char)(record->x * MAX_ROOM_SIZE + record->y);
+			int move = env->moves[from[i]][record->action];
+			to[i] = (unsigned char)(move < MAX_CELLS ? move : from[i]);
+		}
+		resolveClaims(env->numActive, from, to);
+		for (int i = 0; i < env->numActive; ++i) {
+			struct actionrecord *record = &actionRecords[env->active[i]];
+			record->dx = to[i] / MAX_ROOM_SIZE;
+			record->dy = to[i] % MAX_ROOM_SIZE;
+		}
+	} else {
+		memset(collisionMap, NONE, sizeof(collisionMap)); // this DOES work because NONE == -1 == 0xFFF..
+
+		// resolve collisions for each agent in turn
+		for (int i = 0; i < env->numActive; ++i) {
+			int a = env->active[i];
+			struct actionrecord *record = &actionRecords[a];
+			int x = record->x;
+			int y = record->y;
+			int move = env->moves[x * MAX_ROOM_SIZE + y][record->action];
+			if (move < MAX_CELLS) {
+				// agent can move here
+				x = move / MAX_ROOM_SIZE;
+				y = move % MAX_ROOM_SIZE;
+				record->dx = x;
+				record->dy = y;
+			}
+
+			// resolve collisions with other agents by looking up
+			// the collision map - agents that collide stay in place
+			int b = collisionMap[x][y];
+			if (b != NONE) {
+				// collision a->b !
+				// 1. stop b from moving
+				// 2. stop a from moving
+				do {
+					// 1.1. b moves to where it started the turn
+					struct actionrecord *brec = &actionRecords[b];
+					brec->dx = brec->x;
+					brec->dy = brec->y;
+
+					// 1.2. check for new collisions b'->b
+					int next = collisionMap[brec->x][brec->y];
+					collisionMap[brec->x][brec->y] = b;
+					if (next == b) { // if b chose to STAY the chain is broken
+						next = NONE;
+					}
+					b = next; // continue running down the collision chain
+				} while (b != NONE);
+
+				// 2.1. a moves to where it started the turn
+				x = record->x;
+				y = record->y;
+				record->dx = x;
+				record->dy = y;
+
+				// 2.2. check for new collisions with a
+				int c = collisionMap[x][y];
+				while (c != NONE) {
+					// collision c->a !
+					// 2.3. c moves to where it started the turn
+					struct actionrecord *crec = &actionRecords[c];
+					crec->dx = crec->x;
+					crec->dy = crec->y;
+					// 2.4. check for new collisions c'->c
+					int next = collisionMap[crec->x][crec->y];
+					collisionMap[crec->x][crec->y] = c;
+					if (next == c) {
+						next = NONE;
 					}
+					c = next; // continue running down the collision chain
 				}
-				collisionMap[x][y] = a;
 			}
+			collisionMap[x][y] = a;
 		}
 	}
 
 	// act on decision
-	for (int a = 0; a < numAgents; ++a) {
-		if (actionRecords[a].isEscaping) {
-			int  x = actionRecords[a].x;
-			int  y = actionRecords[a].y;
-			int dx = actionRecords[a].dx;
-			int dy = actionRecords[a].dy;
-			action act = actionRecords[a].action;
-
-			// if agent chose to move, but didn't, it might be
-			// because it moved onto a door and so should open it
-			if (act != STAY && x == dx && y == dy) {
-				actionModCoords(act, &x, &y);
-				if (room[x][y] == GLASS) {
-					room[x][y] = SHARDS;
-				} else if (room[x][y] == DOOR) {
-					room[x][y] = OPEN_DOOR;
-				}
-			} else {
-				assert(isPassable(room[dx][dy]));
-				agents[a].x = dx;
-				agents[a].y = dy;
+	for (int i = 0; i < env->numActive; ++i) {
+		int a = env->active[i];
+		int  x = actionRecords[a].x;
+		int  y = actionRecords[a].y;
+		int dx = actionRecords[a].dx;
+		int dy = actionRecords[a].dy;
+		action act = actionRecords[a].action;
+
+		// if agent chose to move, but didn't, it might be
+		// because it moved onto a door and so should open it
+		if (act != STAY && x == dx && y == dy) {
+			int move = env->moves[x * MAX_ROOM_SIZE + y][act];
+			int cell = move >= MAX_CELLS ? move - MAX_CELLS : move;
+			if (boardHas(&env->glass, cell)) {
+				setCell(env, cell / MAX_ROOM_SIZE, cell % MAX_ROOM_SIZE, SHARDS);
+			} else if (boardHas(&env->door, cell)) {
+				setCell(env, cell / MAX_ROOM_SIZE, cell % MAX_ROOM_SIZE, OPEN_DOOR);
+			}
+		} else {
+			assert(boardHas(&env->passable, dx * MAX_ROOM_SIZE + dy));
+			if (x != dx || y != dy) {
+				moveAgent(env, a, dx, dy);
+			}
+		}
+	}
+
+	// the agents have moved, look up the states they are in now all at once
+	int nextStates[MAX_AGENTS];
+	if (!env->readOnly) {
+		getStateIndices(env, TRUE, nextStates);
+		for (int i = 0; i < env->numActive; ++i) {
+			if (nextStates[env->active[i]] != NONE) {
+				prefetchQEntry(env->learner, nextStates[env->active[i]]);
 			}
 		}
 	}
 
+	// if no random numbers decide anything we can look for repeating turns
+	// (with epsilon 0 they are still drawn, but never change an action, and
+	// double Q only needs them to pick the table to learn)
+	const bool watchCycles = (!useDoubleQ || env->readOnly) && env->skipCycles && (!useEpsilon || env->learner->epsilon == 0);
+	bool qChanged = env->lastVersion != env->learner->tableVersion;
+
 	// get reward and learn from decision
-	for (int a = 0; a < numAgents; ++a) {
-		if (actionRecords[a].isEscaping) {
-			int x = agents[a].x;
-			int y = agents[a].y;
-			action act = actionRecords[a].action;
-
-			// assign rewards and determine if state is terminal
-			double reward = idlePunishment;
-			bool isTerminalState = FALSE;
-
-			if (room[x][y] == EXIT) {
-				agents[a].x = ESCAPED;
-				agents[a].y = ESCAPED;
-				isTerminalState = TRUE;
-				reward = escapeReward;
-			} else if (room[x][y] == SHARDS) {
-				agents[a].health -= 1;
-				if (agents[a].health == 0) {
-					isTerminalState = TRUE; // agent died
-					reward = deathPunishment;
-				}
-			} else if (room[x][y] == BANDAGE) {
-				room[x][y] = FLOOR;
-				if (agents[a].health < MAX_HEALTH) {
-					agents[a].health = MAX_HEALTH;
-				}
+	numActive = 0;
+	for (int i = 0; i < env->numActive; ++i) {
+		int a = env->active[i];
+		int x = env->agents[a].x;
+		int y = env->agents[a].y;
+		action act = actionRecords[a].action;
+
+		// assign rewards and determine if state is terminal
+		double reward = env->learner->idlePunishment;
+		bool isTerminalState = FALSE;
+		int cell = x * MAX_ROOM_SIZE + y;
+
+		if (boardHas(&env->exit, cell)) {
+			moveAgent(env, a, ESCAPED, ESCAPED);
+			++env->numEscaped;
+			isTerminalState = TRUE;
+			reward = env->learner->escapeReward;
+		} else if (boardHas(&env->shards, cell)) {
+			env->agents[a].health -= 1;
+			if (env->agents[a].health == 0) {
+				isTerminalState = TRUE; // agent died
+				reward = env->learner->deathPunishment;
+			}
+		} else if (boardHas(&env->bandage, cell)) {
+			setCell(env, x, y, FLOOR);
+			if (env->agents[a].health < MAX_HEALTH) {
+				env->agents[a].health = MAX_HEALTH;
 			}
+		}
 
-			totalReward += reward;
+		env->totalReward += reward;
 
-			if (useDoubleQ) {
-				double *q00 = &actionRecords[a].q0[act];
-				double *q10 = &actionRecords[a].q1[act];
-				double q01 = 0, q11 = 0; // Q[terminal-state] = 0
-				if (!isTerminalState) {
-					double *q01p, *q11p;
-					getQEntry(a, &q01p, &q11p);
-					q01 = *(q01p + getBestAction(q11p, NULL));
-					q11 = *(q11p + getBestAction(q01p, NULL));
-				}
+		// agents that escaped or died are done for this epoch
+		if (!isTerminalState) {
+			env->active[numActive++] = a;
+		}
 
-				// update only 1 Q-table at random
-				if (randf(&globalRNG) < 0.5) {
-					*q00 += alpha * (reward + gamma * q11 - (*q00));
-				} else {
-					*q10 += alpha * (reward + gamma * q01 - (*q10));
-				}
+		// look up the state the agent ended up in, and remember
+		// it for the decision the agent makes next turn
+		env->lastEntries[a].state = NONE;
+		if (env->readOnly) {
+			continue; // nothing to learn
+		}
+		learner *learner = env->learner;
+		qentry *q01p = NULL, *q11p = NULL;
+		if (!isTerminalState) {
+			assert(nextStates[a] != NONE);
+			getQEntryAt(learner, nextStates[a], &q01p, &q11p);
+			env->lastEntries[a].state = nextStates[a];
+			env->lastEntries[a].q0 = q01p;
+			env->lastEntries[a].q1 = q11p;
+		}
+
+		if (useDoubleQ) {
+			double q01 = 0, q11 = 0; // Q[terminal-state] = 0
+			if (!isTerminalState) {
+				q01 = getQWith(learner, q01p, getBestActionAtWith(learner, nextStates[a], BEST_B, q01p, q11p, p), p);
+				q11 = getQWith(learner, q11p, getBestActionAtWith(learner, nextStates[a], BEST_A, q01p, q11p, p), p);
+			}
+
+			// update only 1 Q-table at random
+			struct actionrecord *record = &actionRecords[a];
+			if (agentRand(env, a) < (uint32_t)1 << 31) { // randf < 0.5
+				learnQWith(learner, record->state, record->q0, record->q1, 0, act, reward + learner->gamma * q11, p);
 			} else {
-				double *q0 = &actionRecords[a].q0[act];
-				double q1 = 0; // Q[terminal-state] = 0
-				if (!isTerminalState) {
-					double *qA, *qB;
-					getQEntry(a, &qA, &qB);
-					q1 = *(qA + getBestAction(qA, NULL));
-				}
+				learnQWith(learner, record->state, record->q0, record->q1, 1, act, reward + learner->gamma * q01, p);
+			}
+		} else {
+			double q1 = 0; // Q[terminal-state] = 0
+			if (!isTerminalState) {
+				q1 = getQWith(learner, q01p, getBestActionAtWith(learner, nextStates[a], BEST_A, q01p, q11p, p), p);
+			}
 
-				*q0 += alpha * (reward + gamma * q1 - (*q0));
+			struct actionrecord *record = &actionRecords[a];
+			if (watchCycles) {
+				unsigned char before[NUM_ACTIONS * sizeof(double)];
+				assert(learner->entryBytes <= (int)sizeof(before));
+				memcpy(before, record->q0, learner->entryBytes);
+				learnQWith(learner, record->state, record->q0, record->q1, 0, act, reward + learner->gamma * q1, p);
+				qChanged = qChanged || memcmp(before, record->q0, learner->entryBytes) != 0;
+			} else {
+				learnQWith(learner, record->state, record->q0, record->q1, 0, act, reward + learner->gamma * q1, p);
+			}
+		}
+	}
+	env->numActive = numActive;
+	env->lastVersion = env->learner->tableVersion;
+
+	// if the agents are going round in circles they will until the epoch
+	// ends, all of them getting the idle punishment - so add that up for
+	// the turns that are left, draw the random numbers they would have
+	// drawn, and end the epoch right away
+	env->stableTurns = watchCycles && !qChanged ? env->stableTurns + 1 : 0;
+	if (watchCycles && env->numActive > 0 && findCycle(env)) {
+		for (int turn = env->currTurn + 1; turn < env->maxSteps; ++turn) {
+			for (int i = 0; i < env->numActive; ++i) {
+				if (useEpsilon) {
+					agentRand(env, env->active[i]);
+				}
+				env->totalReward += env->learner->idlePunishment;
 			}
 		}
+		env->currTurn = env->maxSteps - 1;
 	}
 
-	if (++currTurn >= maxSteps || !someAgentsAreEscaping) {
+	if (++env->currTurn >= env->maxSteps || !someAgentsAreEscaping) {
 		// epoch ended - print the results
-		if (printEpochs) {
-			printf("epoch %d: RT = %lg\n", 1 + currEpoch, totalReward);
+		if (env->printEpochs) {
+			printf("epoch %d: RT = %lg\n", 1 + env->currEpoch, env->totalReward);
+		}
+		if (env->resultsFile != NULL) {
+			fprintf(env->resultsFile, "%d, %lg\n", env->currEpoch, env->totalReward);
+		}
+		if (env->epochRewards != NULL) {
+			env->epochRewards[env->currEpoch] = env->totalReward;
 		}
-		if (resultsFile != NULL) {
-			fprintf(resultsFile, "%d, %lg\n", currEpoch, totalReward);
+		if (env->epochEscapes != NULL) {
+			env->epochEscapes[env->currEpoch] = env->numEscaped;
 		}
 
 		// restore all backups
-		++currEpoch;
-		currTurn    = 0;
-		totalReward = 0;
-		memcpy(room, backupRoom, sizeof(room));
-		memcpy(agents, backupAgents, sizeof(agents));
+		++env->currEpoch;
+		env->currTurn    = 0;
+		env->totalReward = 0;
+		env->numEscaped  = 0;
+		memcpy(env->room, env->backupRoom, sizeof(env->backupRoom));
+		memcpy(env->agents, env->backupAgents, sizeof(env->backupAgents));
+		updateBoards(env);
+		updateOccupancy(env);
 
 		return TRUE;
 	}
@@ -652,6 +2219,458 @@ bool simulateTurn() {
 	return FALSE;
 }
 
+// simulateTurn for every combination of double Q, epsilon greedy and precision
+#define TURN_VARIANTS(name, useDoubleQ, useEpsilon) \
+	bool name##Double(env *env) { return simulateTurnWith(env, useDoubleQ, useEpsilon, PRECISION_DOUBLE); } \
+	bool name##Float(env *env)  { return simulateTurnWith(env, useDoubleQ, useEpsilon, PRECISION_FLOAT); } \
+	bool name##Int16(env *env)  { return simulateTurnWith(env, useDoubleQ, useEpsilon, PRECISION_INT16); } \
+	bool name##Int8(env *env)   { return simulateTurnWith(env, useDoubleQ, useEpsilon, PRECISION_INT8); }
+TURN_VARIANTS(turnSingleGreedy,  FALSE, FALSE)
+TURN_VARIANTS(turnSingleEpsilon, FALSE, TRUE)
+TURN_VARIANTS(turnDoubleGreedy,  TRUE,  FALSE)
+TURN_VARIANTS(turnDoubleEpsilon, TRUE,  TRUE)
+
+// indexed by [useDoubleQ][useEpsilon][tablePrecision]
+bool (*const turnVariants[2][2][4])(env *env) = {
+	{
+		{ turnSingleGreedyDouble,  turnSingleGreedyFloat,  turnSingleGreedyInt16,  turnSingleGreedyInt8 },
+		{ turnSingleEpsilonDouble, turnSingleEpsilonFloat, turnSingleEpsilonInt16, turnSingleEpsilonInt8 },
+	},
+	{
+		{ turnDoubleGreedyDouble,  turnDoubleGreedyFloat,  turnDoubleGreedyInt16,  turnDoubleGreedyInt8 },
+		{ turnDoubleEpsilonDouble, turnDoubleEpsilonFloat, turnDoubleEpsilonInt16, turnDoubleEpsilonInt8 },
+	},
+};
+
+// simulate an entire turn of agents escaping, with the variant of
+// simulateTurnWith for the current settings of the learner
+// return TRUE if an epoch has passed after the turn
+bool simulateTurn(env *env) {
+	const learner *learner = env->learner;
+	return turnVariants[learner->useDoubleQ != FALSE][learner->useEpsilon != FALSE][learner->tablePrecision](env);
+}
+
+// a batch of independent runs (setq + epochs) all starting from the same room
+// the runs are shared out between worker threads by runReproduction
+typedef struct reproduction {
+	const env *env;         // every worker simulates its own copy of this
+	int numRuns;
+	int numEpochs;
+	double initialQ;
+	const int *seeds;       // the RNG seed for each run, or NULL to chain the RNG of env
+	double *rewards;        // numRuns x numEpochs total rewards
+	int *escapes;           // numRuns x numEpochs escaped agents, or NULL
+	bool evaluate;          // if TRUE, all workers share the learner of env, read-only
+	volatile long nextRun;  // the next run that no worker has picked up yet
+	volatile long runsDone; // how many runs are finished, used to print progress
+} reproduction;
+
+// atomically increment *x and return its old value
+long atomicIncrement(volatile long *x) {
+#if defined(NOTHREADS)
+	return (*x)++;
+#elif defined(_MSC_VER)
+	return _InterlockedIncrement(x) - 1;
+#else
+	return __sync_fetch_and_add(x, 1);
+#endif
+}
+
+// get the number of cores we can run on
+int countCores() {
+#if defined(NOTHREADS)
+	return 1;
+#elif defined(_WIN32)
+	return (int)GetActiveProcessorCount(0xFFFF); // ALL_PROCESSOR_GROUPS
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (int)cores : 1;
+#endif
+}
+
+// a learner with the same settings as the given one, but without a Q-table
+// call allocQTable before using it, and freeQTable when done
+learner emptyLearner(const learner *from) {
+	learner learner = *from;
+	learner.qTable[0] = NULL;
+	learner.qTable[1] = NULL;
+	learner.qStamps = NULL;
+	learner.qBest = NULL;
+	learner.qMemory = NULL;
+	learner.tableAligned = FALSE;
+	learner.hashKeys = NULL;
+	learner.hashEntries = NULL;
+	learner.arena = NULL;
+	learner.numBlocks = 0;
+	return learner;
+}
+
+// keep taking runs from the reproduction until there are none left
+// every worker has its own environment and learner, so they dont interfere
+void reproduceWorker(reproduction *r) {
+	learner learner = emptyLearner(r->env->learner);
+	env env = *r->env;
+	if (r->evaluate) {
+		env.readOnly = TRUE;
+	} else {
+		env.learner = &learner;
+		allocQTable(&learner, &env);
+	}
+	env.printEpochs = FALSE;
+	env.resultsFile = NULL; // the results are written out in order once all runs are done
+
+	int dotEvery = r->numRuns / 3 > 0 ? r->numRuns / 3 : 1;
+	for (;;) {
+		long run = atomicIncrement(&r->nextRun);
+		if (run >= r->numRuns) {
+			break;
+		}
+
+		// with RNG_STREAMS all runs have the same seed, and each run
+		// uses its own part of the streams of that seed instead
+		// without seeds the run just goes on with the RNG of the run before
+		if (r->seeds != NULL) {
+			seedEnvRun(&env, r->seeds[run], env.rngMode == RNG_STREAMS ? (int)run : 0);
+		}
+		if (!r->evaluate) {
+			loadQTable(&learner, r->initialQ);
+		}
+		env.currEpoch = 0;
+		env.currTurn = 0;
+		env.totalReward = 0;
+		env.numEscaped = 0;
+		env.epochRewards = &r->rewards[run * r->numEpochs];
+		env.epochEscapes = r->escapes == NULL ? NULL : &r->escapes[run * r->numEpochs];
+		for (int epoch = 0; epoch < r->numEpochs; epoch += simulateTurn(&env));
+
+		if ((atomicIncrement(&r->runsDone) + 1) % dotEvery == 0) {
+			printf(".");
+			fflush(stdout);
+		}
+	}
+
+	if (!r->evaluate) {
+		freeQTable(&learner);
+	}
+}
+
+#ifndef NOTHREADS
+#ifdef _WIN32
+unsigned __stdcall reproduceThread(void *r) {
+	reproduceWorker(r);
+	return 0;
+}
+#else
+void *reproduceThread(void *r) {
+	reproduceWorker(r);
+	return NULL;
+}
+#endif
+#endif
+
+// do all the runs of the reproduction on numThreads threads
+void runWorkers(reproduction *r) {
+	int numRuns = r->numRuns;
+	int workers = numThreads > 0 ? numThreads : countCores();
+	if (workers > numRuns) {
+		workers = numRuns;
+	}
+	if (r->seeds == NULL) {
+		workers = 1; // the runs depend on each other, so they go in order
+	}
+
+	// the main thread is the first worker and the others get their own threads
+	// if a thread cant be started the other workers just pick up its runs
+#ifndef NOTHREADS
+#ifdef _WIN32
+	uintptr_t *threads = calloc(workers, sizeof(*threads));
+	for (int t = 1; t < workers; ++t) {
+		threads[t] = _beginthreadex(NULL, 0, reproduceThread, r, 0, NULL);
+	}
+#else
+	pthread_t *threads = calloc(workers, sizeof(*threads));
+	bool *started = calloc(workers, sizeof(*started));
+	for (int t = 1; t < workers; ++t) {
+		started[t] = pthread_create(&threads[t], NULL, reproduceThread, r) == 0;
+	}
+#endif
+#endif
+
+	reproduceWorker(r);
+
+#ifndef NOTHREADS
+#ifdef _WIN32
+	for (int t = 1; t < workers; ++t) {
+		if (threads[t] != 0) {
+			WaitForSingleObject((void *)threads[t], 0xFFFFFFFF); // INFINITE
+			CloseHandle((void *)threads[t]);
+		}
+	}
+#else
+	for (int t = 1; t < workers; ++t) {
+		if (started[t]) {
+			pthread_join(threads[t], NULL);
+		}
+	}
+	free(started);
+#endif
+	free(threads);
+#endif
+}
+
+// do numRuns independent runs of numEpochs each on the room of env (with a
+// copy of its learner) on numThreads threads, every run starts from its own
+// seed and with all Q-values at initialQ - the total reward of every epoch
+// is stored in rewards[run * numEpochs + epoch]
+// if seeds is NULL, the runs are done one after another on 1 thread instead,
+// every run going on with the RNG where the run before it left off
+void runRuns(const env *env, const int *seeds, int numRuns, int numEpochs, double initialQ, double *rewards) {
+	reproduction *r = calloc(1, sizeof(*r));
+	assert(r);
+
+	r->env = env;
+	r->numRuns = numRuns;
+	r->numEpochs = numEpochs;
+	r->initialQ = initialQ;
+	r->seeds = seeds;
+	r->rewards = rewards;
+	runWorkers(r);
+
+	free(r);
+}
+
+// run the policy of the learner of env for 1 epoch on each of numRuns seeds,
+// on numThreads threads without learning, so they all share the same Q-table
+// - the total reward and how many agents escaped in each run are stored in
+// rewards[run] and escapes[run], the seeds come from the seed of env, so
+// evaluating the same policy again gives the same results
+void runEvaluation(const env *env, int numRuns, double *rewards, int *escapes) {
+	int *seeds = malloc(numRuns * sizeof(*seeds));
+	reproduction *r = calloc(1, sizeof(*r));
+	assert(seeds && r);
+
+	for (int run = 0; run < numRuns; ++run) {
+		seeds[run] = env->rngMode == RNG_STREAMS ? env->seed : env->seed + run;
+	}
+
+	// every run starts at the beginning of an epoch
+	struct env copy = *env;
+	if (copy.currTurn > 0) {
+		memcpy(copy.room, copy.backupRoom, sizeof(copy.room));
+		memcpy(copy.agents, copy.backupAgents, sizeof(copy.agents));
+		updateBoards(&copy);
+		updateOccupancy(&copy);
+	}
+
+	r->env = &copy;
+	r->numRuns = numRuns;
+	r->numEpochs = 1;
+	r->seeds = seeds;
+	r->rewards = rewards;
+	r->escapes = escapes;
+	r->evaluate = TRUE;
+	runWorkers(r);
+
+	free(r);
+	free(seeds);
+}
+
+// do numRuns independent runs of numEpochs each on the room of env,
+// resetting the Q-values to initialQ before every run
+// with RNG_COMPAT the runs all go on with the RNG of env, one after another
+// like they did in the paper, so they give exactly the published results
+// otherwise they run on numThreads threads and every run is seeded from
+// env up front, so the results come out the same for any number of threads
+void runReproduction(env *env, int numRuns, int numEpochs, double initialQ) {
+	int *seeds = NULL;
+	double *rewards = malloc((size_t)numRuns * numEpochs * sizeof(*rewards));
+	assert(rewards);
+
+	if (env->rngMode != RNG_COMPAT) {
+		seeds = calloc(numRuns, sizeof(*seeds));
+		assert(seeds);
+		for (int run = 0; run < numRuns; ++run) {
+			seeds[run] = env->rngMode == RNG_STREAMS ? env->seed : (int)nextRand(env);
+		}
+	}
+
+	runRuns(env, seeds, numRuns, numEpochs, initialQ, rewards);
+
+	if (env->resultsFile != NULL) {
+		for (int run = 0; run < numRuns; ++run) {
+			for (int epoch = 0; epoch < numEpochs; ++epoch) {
+				fprintf(env->resultsFile, "%d, %lg\n", epoch, rewards[run * numEpochs + epoch]);
+			}
+		}
+	}
+
+	free(rewards);
+	free(seeds);
+}
+
+// check that the agents learn the same when the Q-values are stored with
+// the given precision as they do with doubles, by doing a few short runs on
+// the room of env with both and comparing the average learning curves
+// prints how far apart they are, and returns TRUE if that is close enough
+// a room without agents learns nothing at all, so it never passes
+bool validatePrecision(env *env, precision p) {
+	enum {
+		RUNS = 32,
+		EPOCHS = 400,
+		WINDOW = 25, // the curves are compared in windows of this many epochs
+	};
+	// the curves may differ by this fraction of the range of the double curve
+	// plus 3 standard errors, since runs that differ in the slightest way
+	// (like the rounding of 1 Q-value) quickly end up taking different paths
+	const double tolerance = 0.05;
+
+	if (env->numAgents == 0) {
+		printf("no agents in the room, cant validate %s\n", precisionNames[p]);
+		return FALSE;
+	}
+
+	printf("validating %s against double on %d runs of %d epochs ",
+		precisionNames[p], RUNS, EPOCHS);
+	fflush(stdout);
+
+	int seeds[RUNS];
+	for (int run = 0; run < RUNS; ++run) {
+		seeds[run] = run + 1;
+	}
+
+	double *rewards[2];
+	learner learners[2] = { *env->learner, *env->learner };
+	learners[0].usePrecision = PRECISION_DOUBLE;
+	learners[1].usePrecision = p;
+	for (int i = 0; i < 2; ++i) {
+		struct env copy = *env;
+		copy.learner = &learners[i];
+		rewards[i] = malloc(RUNS * EPOCHS * sizeof(double));
+		assert(rewards[i]);
+		runRuns(&copy, seeds, RUNS, EPOCHS, env->learner->optimism, rewards[i]);
+	}
+
+	// average every window over all the runs, and how much that varies
+	double mean[2][EPOCHS / WINDOW];
+	double variance[2][EPOCHS / WINDOW];
+	double lowest = INFINITY;
+	double highest = -INFINITY;
+	for (int w = 0; w < EPOCHS / WINDOW; ++w) {
+		for (int i = 0; i < 2; ++i) {
+			double sum = 0, sumSquares = 0;
+			for (int run = 0; run < RUNS; ++run) {
+				double runMean = 0;
+				for (int epoch = w * WINDOW; epoch < (w + 1) * WINDOW; ++epoch) {
+					runMean += rewards[i][run * EPOCHS + epoch] / WINDOW;
+				}
+				sum += runMean;
+				sumSquares += runMean * runMean;
+			}
+			mean[i][w] = sum / RUNS;
+			variance[i][w] = fmax(0, sumSquares / RUNS - mean[i][w] * mean[i][w]) * RUNS / (RUNS - 1);
+		}
+		lowest = fmin(lowest, mean[0][w]);
+		highest = fmax(highest, mean[0][w]);
+	}
+
+	// find the window where the curves are furthest apart, relative to what is allowed
+	bool ok = TRUE;
+	double worst = 0, worstAllowed = 0;
+	for (int w = 0; w < EPOCHS / WINDOW; ++w) {
+		double deviation = fabs(mean[1][w] - mean[0][w]);
+		double allowed = tolerance * fmax(1, highest - lowest) +
+			3 * sqrt((variance[0][w] + variance[1][w]) / RUNS);
+		if (w == 0 || deviation / allowed > worst / worstAllowed) {
+			worst = deviation;
+			worstAllowed = allowed;
+		}
+		ok = ok && deviation <= allowed;
+	}
+	printf(" curves differ by up to %.1lf where %.1lf is allowed\n", worst, worstAllowed);
+
+	free(rewards[0]);
+	free(rewards[1]);
+	return ok;
+}
+
+// validate the given precision on every room and setting of the paper (see
+// the reproduce command), whatever room is loaded right now, since the
+// precision stays in use when another room is loaded later on
+// the rooms are loaded into a copy of env, so env itself doesnt change
+bool validatePaperPrecision(const env *env, precision p) {
+	static const struct {
+		const char *room;
+		bool doubleQ;
+		double alpha, gamma, initialQ;
+	} setups[] = {
+		{ "room1.txt", FALSE, 0.2,  0.9, 100 },
+		{ "room2.txt", FALSE, 0.2,  0.9, 100 },
+		{ "room3.txt", FALSE, 0.2,  0.9, 100 },
+		{ "room1.txt", TRUE,  0.2,  0.9, 50 },
+		{ "room2.txt", TRUE,  0.3,  0.8, 50 },
+		{ "room3.txt", TRUE,  0.15, 0.8, 50 },
+	};
+
+	bool ok = TRUE;
+	for (size_t i = 0; ok && i < sizeof(setups) / sizeof(setups[0]); ++i) {
+		learner learner = emptyLearner(env->learner);
+		learner.usePrecision = PRECISION_DOUBLE;
+		learner.useDoubleQ = setups[i].doubleQ;
+		learner.alpha = setups[i].alpha;
+		learner.gamma = setups[i].gamma;
+		learner.epsilon = 0.005;
+		learner.optimism = setups[i].initialQ;
+
+		struct env copy = *env;
+		copy.learner = &learner;
+		loadRoom(&copy, setups[i].room);
+		printf("%s%s: ", setups[i].room, setups[i].doubleQ ? " (double Q)" : "");
+		ok = validatePrecision(&copy, p);
+
+		freeQTable(&learner);
+	}
+	return ok;
+}
+
+// simulate numEpochs epochs on a copy of the environment, starting out with
+// fresh Q-values and the current settings, and print how fast that went
+// this doesnt change the environment (or its learner) at all
+void runBenchmark(const env *env, int numEpochs) {
+	learner learner = emptyLearner(env->learner);
+	struct env copy = *env;
+
+	// the benchmark starts at the beginning of an epoch
+	if (copy.currTurn > 0) {
+		memcpy(copy.room, copy.backupRoom, sizeof(copy.room));
+		memcpy(copy.agents, copy.backupAgents, sizeof(copy.agents));
+		updateBoards(&copy);
+		updateOccupancy(&copy);
+	}
+	copy.currEpoch = 0;
+	copy.currTurn = 0;
+	copy.totalReward = 0;
+	copy.numEscaped = 0;
+
+	copy.learner = &learner;
+	allocQTable(&learner, &copy);
+	loadQTable(&learner, env->learner->optimism);
+	copy.printEpochs = FALSE;
+	copy.resultsFile = NULL;
+	copy.epochRewards = NULL;
+	copy.epochEscapes = NULL;
+
+	long numTurns = 0;
+	clock_t start = clock();
+	for (int epoch = 0; epoch < numEpochs; ++numTurns) {
+		epoch += simulateTurn(&copy);
+	}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%d epochs, %ld turns in %.2lf s: %.0lf turns/sec\n",
+		numEpochs, numTurns, seconds, seconds > 0 ? numTurns / seconds : 0);
+
+	freeQTable(&learner);
+}
+
 //           __
 //           ||
 // o====================o
@@ -676,11 +2695,20 @@ void printCLIHelp() {
 	printf(" e|epochs [N]  advance N epochs (default=1)\n");
 	printf(" t|turns [N]   advance N turns (default=1)\n");
 	printf(" s|seed N      seed the RNG\n");
+	printf(" rngmode [M]   use compat|lanes|streams RNG\n");
+	printf(" bench [N]     time N epochs (default=1000)\n");
+	printf(" eval [N]      run policy on N seeds (default=100)\n");
+	printf(" bumps [M]     bump agents by chains|claims\n");
+	printf(" cycles 1|0    toggle skipping repeated turns\n");
+	printf(" threads N     use N threads, 0=all cores\n");
 	printf(" alpha X       set alpha to X\n");
 	printf(" gamma X       set gamma to X\n");
 	printf(" epsilon X     set epsilon to X\n");
 	printf(" setq X        set Q-values to X\n");
 	printf(" doubleq 1|0   toggle double Q-learning\n");
+	printf(" qcache 1|0    toggle caching greedy actions\n");
+	printf(" qbackend [B]  use dense|aligned|sparse Q-table\n");
+	printf(" precision [P] store Q as double|float|int16|int8\n");
 	printf(" load F        load room file F\n");
 	printf(" saveto F      save results to file F\n");
 	printf(" reproduce     get results used in the paper\n");
@@ -738,8 +2766,8 @@ void runCmd(const char *command) {
 		}
 	} else if (cmdIs("quit", cmd) || cmdIs("q", cmd) || cmdIs("exit", cmd)) {
 		if (!*arg) {
-			if (resultsFile != NULL) {
-				fclose(resultsFile);
+			if (globalEnv.resultsFile != NULL) {
+				fclose(globalEnv.resultsFile);
 			}
 			exit(0);
 		} else {
@@ -747,11 +2775,11 @@ void runCmd(const char *command) {
 		}
 	} else if (cmdIs("room", cmd) || cmdIs("r", cmd)) {
 		if (!*arg) {
-			for (int y = roomHeight - 1; y >= 0; --y) {
-				for (int x = 0; x < roomWidth; ++x) {
-					int agent = agentAt(x, y);
+			for (int y = globalEnv.roomHeight - 1; y >= 0; --y) {
+				for (int x = 0; x < globalEnv.roomWidth; ++x) {
+					int agent = agentAt(&globalEnv, x, y);
 					if (agent != NONE) {
-						int hp = agents[agent].health;
+						int hp = globalEnv.agents[agent].health;
 						if (hp == MAX_HEALTH) {
 							putchar('@');
 						} else if (hp > 0) {
@@ -760,7 +2788,7 @@ void runCmd(const char *command) {
 							putchar('x');
 						}
 					} else {
-						putchar(room[x][y]);
+						putchar(globalEnv.room[x][y]);
 					}
 				}
 				putchar('\n');
@@ -773,91 +2801,243 @@ void runCmd(const char *command) {
 		if (sscanf(arg, "%d", &numEpochs) != 1) {
 			numEpochs = 1;
 		}
-		for (int epoch = 0; epoch < numEpochs; epoch += simulateTurn());
+		for (int epoch = 0; epoch < numEpochs; epoch += simulateTurn(&globalEnv));
+	} else if (cmdIs("bench", cmd)) {
+		int numEpochs;
+		if (sscanf(arg, "%d", &numEpochs) != 1) {
+			numEpochs = 1000;
+		}
+		runBenchmark(&globalEnv, numEpochs);
+	} else if (cmdIs("eval", cmd)) {
+		int numRuns;
+		if (sscanf(arg, "%d", &numRuns) != 1) {
+			numRuns = 100;
+		}
+		if (numRuns > 0) {
+			double *rewards = malloc(numRuns * sizeof(*rewards));
+			int *escapes = malloc(numRuns * sizeof(*escapes));
+			assert(rewards && escapes);
+			printf("evaluating ");
+			runEvaluation(&globalEnv, numRuns, rewards, escapes);
+
+			double sum = 0, sumSquares = 0, escaped = 0;
+			for (int run = 0; run < numRuns; ++run) {
+				sum += rewards[run];
+				sumSquares += rewards[run] * rewards[run];
+				escaped += escapes[run];
+			}
+			double mean = sum / numRuns;
+			double variance = sumSquares / numRuns - mean * mean;
+			printf(" %d runs: RT = %lg +- %lg, %.2lf agents escaped\n",
+				numRuns, mean, sqrt(variance > 0 ? variance : 0), escaped / numRuns);
+			free(escapes);
+			free(rewards);
+		} else {
+			printf("invalid argument N: must be > 0\n");
+		}
 	} else if (cmdIs("turns", cmd) || cmdIs("t", cmd)) {
 		int numTurns;
 		if (sscanf(arg, "%d", &numTurns) != 1) {
 			numTurns = 1;
 		}
 		for (int turn = 1; turn < numTurns; ++turn) {
-			simulateTurn();
+			simulateTurn(&globalEnv);
 		}
 	} else if (cmdIs("seed", cmd) || cmdIs("s", cmd)) {
 		int seed;
 		if (sscanf(arg, "%d", &seed) == 1) {
-			globalRNG = seedRNG(seed);
+			seedEnv(&globalEnv, seed);
 		} else {
 			printf("missing argument N\n");
 		}
+	} else if (cmdIs("rngmode", cmd)) {
+		int mode = NONE;
+		for (int i = RNG_COMPAT; i <= RNG_STREAMS; ++i) {
+			if (strcmp(arg, rngModeNames[i]) == 0) {
+				mode = i;
+			}
+		}
+		if (mode != NONE) {
+			// start the new mode from the last seed, so it always gives the same numbers
+			if (mode != (int)globalEnv.rngMode) {
+				globalEnv.rngMode = mode;
+				seedEnv(&globalEnv, globalEnv.seed);
+			}
+		} else if (*arg) {
+			printf("invalid argument M: must be compat, lanes or streams\n");
+		}
+		printf("random numbers come from %s\n",
+			globalEnv.rngMode == RNG_LANES ? "interleaved streams" :
+			globalEnv.rngMode == RNG_STREAMS ? "a stream per agent and run" :
+			"a single stream, like in the paper");
+	} else if (cmdIs("bumps", cmd)) {
+		int mode = NONE;
+		for (int i = BUMP_CHAINS; i <= BUMP_CLAIMS; ++i) {
+			if (strcmp(arg, bumpModeNames[i]) == 0) {
+				mode = i;
+			}
+		}
+		if (mode != NONE) {
+			globalEnv.bumpMode = mode;
+		} else if (*arg) {
+			printf("invalid argument M: must be chains or claims\n");
+		}
+		printf("agents are bumped %s\n", globalEnv.bumpMode == BUMP_CLAIMS ?
+			"all at once, by counting claims on cells" :
+			"one by one, by following collision chains");
+	} else if (cmdIs("cycles", cmd)) {
+		int skipCycles;
+		if (sscanf(arg, "%d", &skipCycles) == 1) {
+			if (skipCycles == 0 || skipCycles == 1) {
+				globalEnv.skipCycles = skipCycles;
+			} else {
+				printf("invalid argument: must be 0 or 1\n");
+			}
+		} else {
+			printf("skipping repeated turns is %s\n", globalEnv.skipCycles ? "on" : "off");
+		}
+	} else if (cmdIs("threads", cmd)) {
+		int n;
+		if (sscanf(arg, "%d", &n) == 1) {
+			if (n >= 0) {
+				numThreads = n;
+			} else {
+				printf("invalid argument N: must be >= 0\n");
+			}
+		} else {
+			printf("using %d threads\n", numThreads > 0 ? numThreads : countCores());
+		}
 	} else if (cmdIs("alpha", cmd)) {
 		double a;
 		if (sscanf(arg, "%lf", &a) == 1) {
 			if (a >= 0 && a <= 1) {
-				alpha = a;
+				globalLearner.alpha = a;
 			} else {
 				printf("invalid argument X: must be in [0,1]\n");
 			}
 		} else {
-			printf("alpha = %lg\n", alpha);
+			printf("alpha = %lg\n", globalLearner.alpha);
 		}
 	} else if (cmdIs("gamma", cmd)) {
 		double g;
 		if (sscanf(arg, "%lf", &g) == 1) {
 			if (g >= 0 && g <= 1) {
-				gamma = g;
+				globalLearner.gamma = g;
 			} else {
 				printf("invalid argument X: must be in [0,1]\n");
 			}
 		} else {
-			printf("gamma = %lg\n", gamma);
+			printf("gamma = %lg\n", globalLearner.gamma);
 		}
 	} else if (cmdIs("epsilon", cmd)) {
 		double e;
 		if (sscanf(arg, "%lf", &e) == 1) {
 			if (e >= 0 && e <= 1) {
-				epsilon = e;
+				globalLearner.epsilon = e;
 			} else {
 				printf("invalid argument X: must be in [0,1]\n");
 			}
 		} else {
-			printf("epsilon = %lg\n", epsilon);
+			printf("epsilon = %lg\n", globalLearner.epsilon);
 		}
 	} else if (cmdIs("setq", cmd)) {
 		double qValues;
 		if (sscanf(arg, "%lf", &qValues) == 1) {
-			loadQTable(qValues);
-			currEpoch = 0;
+			loadQTable(&globalLearner, qValues);
+			globalEnv.currEpoch = 0;
 		} else {
-			printf("optimism = %lg\n", optimism);
+			printf("optimism = %lg\n", globalLearner.optimism);
 		}
 	} else if (cmdIs("doubleq", cmd) || cmdIs("dq", cmd)) {
 		bool doubleQ;
 		if (sscanf(arg, "%d", &doubleQ) == 1) {
 			if (doubleQ == 0 || doubleQ == 1) {
-				useDoubleQ = doubleQ;
+				globalLearner.useDoubleQ = doubleQ;
+				allocQTable(&globalLearner, &globalEnv);
+			} else {
+				printf("invalid argument: must be 0 or 1\n");
+			}
+		} else {
+			printf("double Q-learning is %s\n", globalLearner.useDoubleQ ? "on" : "off");
+		}
+	} else if (cmdIs("qcache", cmd)) {
+		int bestCache;
+		if (sscanf(arg, "%d", &bestCache) == 1) {
+			if (bestCache == 0 || bestCache == 1) {
+				globalLearner.useBestCache = bestCache == 1;
+				allocQTable(&globalLearner, &globalEnv);
 			} else {
 				printf("invalid argument: must be 0 or 1\n");
 			}
 		} else {
-			printf("double Q-learning is %s\n", useDoubleQ ? "on" : "off");
+			printf("greedy action cache is %s\n", globalLearner.useBestCache ? "on" : "off");
+		}
+	} else if (cmdIs("qbackend", cmd)) {
+		if (strcmp(arg, "dense") == 0 || strcmp(arg, "aligned") == 0 || strcmp(arg, "sparse") == 0) {
+			globalLearner.useSparseQ = strcmp(arg, "sparse") == 0;
+			globalLearner.useAlignedQ = strcmp(arg, "aligned") == 0;
+			allocQTable(&globalLearner, &globalEnv);
+		} else if (*arg) {
+			printf("invalid argument B: must be dense, aligned or sparse\n");
+		}
+		printf("%s Q-table: %zu states visited, %.2lf MB\n",
+			globalLearner.useSparseQ ? "sparse" : globalLearner.tableAligned ? "aligned" : "dense",
+			qTableStates(&globalLearner),
+			qTableMemory(&globalLearner) / (1024.0 * 1024.0));
+	} else if (cmdIs("precision", cmd)) {
+		// anything other than double has to learn like double does in the paper first
+		int p = NONE;
+		for (int i = PRECISION_DOUBLE; i <= PRECISION_INT8; ++i) {
+			if (strcmp(arg, precisionNames[i]) == 0) {
+				p = i;
+			}
 		}
+		if (p != NONE) {
+			// the room that is loaded now is checked too, with the current settings
+			if (p == PRECISION_DOUBLE || (validatePaperPrecision(&globalEnv, p) &&
+				(globalEnv.numAgents == 0 || validatePrecision(&globalEnv, p)))) {
+				globalLearner.usePrecision = p;
+				allocQTable(&globalLearner, &globalEnv);
+			} else {
+				printf("%s doesnt learn the same as double, not using it\n", precisionNames[p]);
+			}
+		} else if (*arg) {
+			printf("invalid argument P: must be double, float, int16 or int8\n");
+		}
+		printf("Q-values are stored as %s (%d bytes per state)\n",
+			precisionNames[globalLearner.tablePrecision], globalLearner.entryBytes);
 	} else if (cmdIs("load", cmd) || cmdIs("loadr", cmd)) {
 		if (*arg != 0) {
-			loadRoom(arg);
+			loadRoom(&globalEnv, arg);
+			// the precision might not learn like double does in the new room
+			precision p = globalLearner.usePrecision;
+			if (p != PRECISION_DOUBLE && globalEnv.numAgents > 0 && !validatePrecision(&globalEnv, p)) {
+				printf("%s doesnt learn the same as double in this room, using double\n", precisionNames[p]);
+				globalLearner.usePrecision = PRECISION_DOUBLE;
+				allocQTable(&globalLearner, &globalEnv);
+			}
 		} else {
 			printf("missing argument F\n");
 		}
 	} else if (cmdIs("saveto", cmd)) {
 		if (*arg != 0) {
-			openResultsFile(arg);
+			openResultsFile(&globalEnv, arg);
 		} else {
 			printf("missing argument F\n");
 		}
 	} else if (cmdIs("reproduce", cmd)) {
 		if (!*arg) {
 			int numRuns = 200;
-			printEpochs = FALSE;
-			printf("reproducing paper results ... this may take up to 10 minutes\n");
+			globalEnv.printEpochs = FALSE;
+			// only the single chained stream of compat gives the published numbers
+			if (globalEnv.rngMode == RNG_COMPAT) {
+				printf("reproducing paper results (rngmode compat, 1 thread) ... this may take a few minutes\n");
+			} else {
+				int threads = numThreads > 0 ? numThreads : countCores();
+				printf("running the paper experiments (rngmode %s, %d thread%s, not the published numbers)"
+					" ... this may take a few minutes\n",
+					rngModeNames[globalEnv.rngMode], threads, threads == 1 ? "" : "s");
+			}
 			runCmd("epsilon 0.005");
 
 			runCmd("doubleq 0");
@@ -868,39 +3048,21 @@ void runCmd(const char *command) {
 				runCmd("load room1.txt");
 				runCmd("saveto results1.csv");
 				printf("reproducing room1 ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 100");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 100);
 				printf(" done\n");
 
 				runCmd("seed 42");
 				runCmd("load room2.txt");
 				runCmd("saveto results2.csv");
 				printf("reproducing room2 ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 100");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 100);
 				printf(" done\n");
 
 				runCmd("seed 42");
 				runCmd("load room3.txt");
 				runCmd("saveto results3.csv");
 				printf("reproducing room3 ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 100");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 100);
 				printf(" done\n");
 			}
 
@@ -912,13 +3074,7 @@ void runCmd(const char *command) {
 				runCmd("load room1.txt");
 				runCmd("saveto results1d.csv");
 				printf("reproducing room1 (double Q) ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 50");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 50);
 				printf(" done\n");
 
 				runCmd("seed 42");
@@ -927,13 +3083,7 @@ void runCmd(const char *command) {
 				runCmd("load room2.txt");
 				runCmd("saveto results2d.csv");
 				printf("reproducing room2 (double Q) ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 50");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 50);
 				printf(" done\n");
 
 				runCmd("seed 42");
@@ -942,19 +3092,13 @@ void runCmd(const char *command) {
 				runCmd("load room3.txt");
 				runCmd("saveto results3d.csv");
 				printf("reproducing room3 (double Q) ");
-				for (int run = 0; run < numRuns; ++run) {
-					runCmd("setq 50");
-					runCmd("epochs 3000");
-					if ((run + 1) % (numRuns / 3) == 0) {
-						printf(".");
-					}
-				}
+				runReproduction(&globalEnv, numRuns, 3000, 50);
 				printf(" done\n");
 			}
 
 			runCmd("saveto results_.csv");
 			printf("reproduction complete :)\n");
-			printEpochs = TRUE;
+			globalEnv.printEpochs = TRUE;
 		} else {
 			printf("excessive argument '%s'\n", arg);
 		}
@@ -1166,31 +3310,33 @@ double clampf(double x, double min, double max) {
 
 // insert new agent at specified index and (x,y)
 void insertAgent(int index, int x, int y) {
-	assert(index >= 0 && index <= numAgents);
-	assert(numAgents < MAX_AGENTS);
-	if (index != numAgents) {
+	assert(index >= 0 && index <= globalEnv.numAgents);
+	assert(globalEnv.numAgents < MAX_AGENTS);
+	if (index != globalEnv.numAgents) {
 		memmove(
-			&agents[index + 1],
-			&agents[index],
-			(numAgents - index) * sizeof(*agents));
+			&globalEnv.agents[index + 1],
+			&globalEnv.agents[index],
+			(globalEnv.numAgents - index) * sizeof(*globalEnv.agents));
 	}
-	++numAgents;
+	++globalEnv.numAgents;
 
-	agents[index].x = x;
-	agents[index].y = y;
-	agents[index].health = MAX_HEALTH;
+	globalEnv.agents[index].x = x;
+	globalEnv.agents[index].y = y;
+	globalEnv.agents[index].health = MAX_HEALTH;
+	updateOccupancy(&globalEnv);
 }
 
 // remove agent at specified index
 void removeAgent(int index) {
-	assert(index >= 0 && index < numAgents);
-	--numAgents;
-	if (index != numAgents) {
+	assert(index >= 0 && index < globalEnv.numAgents);
+	--globalEnv.numAgents;
+	if (index != globalEnv.numAgents) {
 		memmove(
-			&agents[index],
-			&agents[index + 1],
-			(numAgents - index) * sizeof(*agents));
+			&globalEnv.agents[index],
+			&globalEnv.agents[index + 1],
+			(globalEnv.numAgents - index) * sizeof(*globalEnv.agents));
 	}
+	updateOccupancy(&globalEnv);
 }
 
 // return the cell as a string so that we can print it to the user
@@ -1231,33 +3377,34 @@ bool performChange(change ch, int x, int y, int cellOrAgent, int groupSize) {
 		switch (ch) {
 			case REPLACE_CELL: {
 				// check if cell is inside the room
-				if (isInRoom(x, y)) {
+				if (isInRoom(&globalEnv, x, y)) {
 					char newCell = (char)cellOrAgent;
-					char oldCell = room[x][y];
+					char oldCell = globalEnv.room[x][y];
 
 					// check if new cell is actually different
 					if (oldCell != newCell) {
 						// we cant place an unpassable
 						// cell on top of an agent
-						if (isPassable(newCell) || agentAt(x, y) < 0) {
+						if (isPassable(newCell) || agentAt(&globalEnv, x, y) < 0) {
 							commit = TRUE;
 							change.replaceCell.x = x;
 							change.replaceCell.y = y;
 							change.replaceCell.oldCell = oldCell;
 							change.replaceCell.newCell = newCell;
-							room[x][y] = newCell;
+							setCell(&globalEnv, x, y, newCell);
+							allocQTable(&globalLearner, &globalEnv); // the layout changed
 						}
 					}
 				}
 			} break;
 			case INSERT_AGENT: {
 				// check if new agent is being placed inside the room
-				if (isInRoom(x, y)) {
+				if (isInRoom(&globalEnv, x, y)) {
 					int agent = cellOrAgent;
 					// check if index is valid
-					if (agent >= 0 && agent <= numAgents) {
+					if (agent >= 0 && agent <= globalEnv.numAgents) {
 						// we cant place an agent on an unpassable cell
-						if (agentAt(x, y) < 0 && isPassable(room[x][y])) {
+						if (agentAt(&globalEnv, x, y) < 0 && isPassable(globalEnv.room[x][y])) {
 							commit = TRUE;
 							change.insertAgent.x = x;
 							change.insertAgent.y = y;
@@ -1271,12 +3418,12 @@ bool performChange(change ch, int x, int y, int cellOrAgent, int groupSize) {
 			case REMOVE_AGENT: {
 				int agent = cellOrAgent;
 				// check if index if valid
-				if (agent >= 0 && agent < numAgents) {
+				if (agent >= 0 && agent < globalEnv.numAgents) {
 					commit = TRUE;
-					change.insertAgent.x = agents[agent].x;
-					change.insertAgent.y = agents[agent].y;
+					change.insertAgent.x = globalEnv.agents[agent].x;
+					change.insertAgent.y = globalEnv.agents[agent].y;
 					change.insertAgent.agentIndex = agent;
-					change.insertAgent.agentHealth = agents[agent].health;
+					change.insertAgent.agentHealth = globalEnv.agents[agent].health;
 					removeAgent(agent);
 				}
 			} break;
@@ -1284,25 +3431,25 @@ bool performChange(change ch, int x, int y, int cellOrAgent, int groupSize) {
 				// check if new size is valid and different from old size
 				if (x > 0 && x <= MAX_ROOM_SIZE &&
 					y > 0 && y <= MAX_ROOM_SIZE &&
-					(x != roomWidth || y != roomHeight)) {
+					(x != globalEnv.roomWidth || y != globalEnv.roomHeight)) {
 					commit = TRUE;
 					assert(change.groupSize == 1);
 					change.resizeRoom.newWidth = x;
 					change.resizeRoom.newHeight = y;
-					change.resizeRoom.oldWidth = roomWidth;
-					change.resizeRoom.oldHeight = roomHeight;
+					change.resizeRoom.oldWidth = globalEnv.roomWidth;
+					change.resizeRoom.oldHeight = globalEnv.roomHeight;
 
 					// if the new size is smaller then we need
 					// remove all agents and replace all cells
 					// that are being cut off and place them
 					// in the same change group
-					if (x < roomWidth || y < roomHeight) {
+					if (x < globalEnv.roomWidth || y < globalEnv.roomHeight) {
 						int numChanges = 0;
 
 						// remove all cells outside new room dimensions
-						for (int cx = 0; cx < roomWidth; ++cx) {
-							for (int cy = 0; cy < roomHeight; ++cy) {
-								if ((cx >= x || cy >= y) && room[cx][cy] != FLOOR) {
+						for (int cx = 0; cx < globalEnv.roomWidth; ++cx) {
+							for (int cy = 0; cy < globalEnv.roomHeight; ++cy) {
+								if ((cx >= x || cy >= y) && globalEnv.room[cx][cy] != FLOOR) {
 									++numChanges;
 									bool success = performChange(REPLACE_CELL, cx, cy, FLOOR, 1);
 									assert(success);
@@ -1311,16 +3458,18 @@ bool performChange(change ch, int x, int y, int cellOrAgent, int groupSize) {
 						}
 
 						// then remove agents
-						for (int a = 0; a < numAgents; ++a) {
-							if (agents[a].x >= x || agents[a].y >= y) {
+						for (int a = 0; a < globalEnv.numAgents; ++a) {
+							if (globalEnv.agents[a].x >= x || globalEnv.agents[a].y >= y) {
 								++numChanges;
 								bool success = performChange(REMOVE_AGENT, 0, 0, a--, 1);
 								assert(success);
 							}
 						}
 
-						roomWidth = x;
-						roomHeight = y;
+						globalEnv.roomWidth = x;
+						globalEnv.roomHeight = y;
+						roomResized(&globalEnv);
+						updateOccupancy(&globalEnv);
 
 						// set the correct group sizes
 						assert(undoTop - numChanges >= 0);
@@ -1334,13 +3483,14 @@ bool performChange(change ch, int x, int y, int cellOrAgent, int groupSize) {
 						// fill new space with FLOORs
 						for (int cx = 0; cx < x; ++cx) {
 							for (int cy = 0; cy < y; ++cy) {
-								if (cx >= roomWidth || cy >= roomHeight) {
-									room[cx][cy] = FLOOR;
+								if (cx >= globalEnv.roomWidth || cy >= globalEnv.roomHeight) {
+									globalEnv.room[cx][cy] = FLOOR;
 								}
 							}
 						}
-						roomWidth = x;
-						roomHeight = y;
+						globalEnv.roomWidth = x;
+						globalEnv.roomHeight = y;
+						roomResized(&globalEnv);
 					}
 				}
 			} break;
@@ -1403,17 +3553,18 @@ void undo() {
 					int y = change.replaceCell.y;
 					char newCell = change.replaceCell.newCell;
 					char oldCell = change.replaceCell.oldCell;
-					assert(isInRoom(x, y));
+					assert(isInRoom(&globalEnv, x, y));
 					assert(newCell != oldCell);
-					room[x][y] = oldCell;
+					setCell(&globalEnv, x, y, oldCell);
+					allocQTable(&globalLearner, &globalEnv);
 				} break;
 				case INSERT_AGENT: {
 					int x = change.insertAgent.x;
 					int y = change.insertAgent.y;
 					int a = change.insertAgent.agentIndex;
 					int h = change.insertAgent.agentHealth;
-					assert(isInRoom(x, y));
-					assert(a >= 0 && a < numAgents);
+					assert(isInRoom(&globalEnv, x, y));
+					assert(a >= 0 && a < globalEnv.numAgents);
 					assert(h >= 0 && h <= MAX_HEALTH);
 					removeAgent(a);
 				} break;
@@ -1422,11 +3573,11 @@ void undo() {
 					int y = change.removeAgent.y;
 					int a = change.removeAgent.agentIndex;
 					int h = change.removeAgent.agentHealth;
-					assert(isInRoom(x, y));
-					assert(a >= 0 && a <= numAgents);
+					assert(isInRoom(&globalEnv, x, y));
+					assert(a >= 0 && a <= globalEnv.numAgents);
 					assert(h >= 0 && h <= MAX_HEALTH);
 					insertAgent(a, x, y);
-					agents[a].health = h;
+					globalEnv.agents[a].health = h;
 				} break;
 				case RESIZE_ROOM: {
 					int newW = change.resizeRoom.newWidth;
@@ -1438,8 +3589,10 @@ void undo() {
 					assert(oldW > 0 && oldW <= MAX_ROOM_SIZE);
 					assert(newH > 0 && newH <= MAX_ROOM_SIZE);
 					assert(oldH > 0 && oldH <= MAX_ROOM_SIZE);
-					roomWidth  = oldW;
-					roomHeight = oldH;
+					globalEnv.roomWidth  = oldW;
+					globalEnv.roomHeight = oldH;
+					roomResized(&globalEnv);
+					updateOccupancy(&globalEnv);
 				} break;
 				default: assert(FALSE); break;
 			}
@@ -1465,28 +3618,29 @@ void redo() {
 					int y = change.replaceCell.y;
 					char newCell = change.replaceCell.newCell;
 					char oldCell = change.replaceCell.oldCell;
-					assert(isInRoom(x, y));
+					assert(isInRoom(&globalEnv, x, y));
 					assert(newCell != oldCell);
-					room[x][y] = newCell;
+					setCell(&globalEnv, x, y, newCell);
+					allocQTable(&globalLearner, &globalEnv);
 				} break;
 				case INSERT_AGENT: {
 					int x = change.insertAgent.x;
 					int y = change.insertAgent.y;
 					int a = change.insertAgent.agentIndex;
 					int h = change.removeAgent.agentHealth;
-					assert(isInRoom(x, y));
-					assert(a >= 0 && a <= numAgents);
+					assert(isInRoom(&globalEnv, x, y));
+					assert(a >= 0 && a <= globalEnv.numAgents);
 					assert(h >= 0 && h <= MAX_HEALTH);
 					insertAgent(a, x, y);
-					agents[a].health = h;
+					globalEnv.agents[a].health = h;
 				} break;
 				case REMOVE_AGENT: {
 					int x = change.insertAgent.x;
 					int y = change.insertAgent.y;
 					int a = change.insertAgent.agentIndex;
 					int h = change.removeAgent.agentHealth;
-					assert(isInRoom(x, y));
-					assert(a >= 0 && a < numAgents);
+					assert(isInRoom(&globalEnv, x, y));
+					assert(a >= 0 && a < globalEnv.numAgents);
 					assert(h >= 0 && h <= MAX_HEALTH);
 					removeAgent(a);
 				} break;
@@ -1500,8 +3654,10 @@ void redo() {
 					assert(oldW > 0 && oldW <= MAX_ROOM_SIZE);
 					assert(newH > 0 && newH <= MAX_ROOM_SIZE);
 					assert(oldH > 0 && oldH <= MAX_ROOM_SIZE);
-					roomWidth  = newW;
-					roomHeight = newH;
+					globalEnv.roomWidth  = newW;
+					globalEnv.roomHeight = newH;
+					roomResized(&globalEnv);
+					updateOccupancy(&globalEnv);
 				} break;
 				default: assert(FALSE); break;
 			}
@@ -1756,17 +3912,17 @@ void drawCell(char c, double x, double y, double size, double opacity, void *add
 			// use address to figure out the indices
 			// into the global room array
 			char *ca = address;
-			if (ca >= &room[0][0] && ca <= &room[MAX_ROOM_SIZE - 1][MAX_ROOM_SIZE - 1]) {
+			if (ca >= &globalEnv.room[0][0] && ca <= &globalEnv.room[MAX_ROOM_SIZE - 1][MAX_ROOM_SIZE - 1]) {
 				// cell is actually a part of the room
-				int offset = (int)(ca - &room[0][0]);
+				int offset = (int)(ca - &globalEnv.room[0][0]);
 				int cx = offset / MAX_ROOM_SIZE;
 				int cy = offset % MAX_ROOM_SIZE;
 
 				// check all neighbor cells to see where the door should connect
-				hNeighbors += (!isInRoom(cx - 1, cy) || room[cx - 1][cy] != FLOOR);
-				hNeighbors += (!isInRoom(cx + 1, cy) || room[cx + 1][cy] != FLOOR);
-				vNeighbors += (!isInRoom(cx, cy - 1) || room[cx][cy - 1] != FLOOR);
-				vNeighbors += (!isInRoom(cx, cy + 1) || room[cx][cy + 1] != FLOOR);
+				hNeighbors += (!isInRoom(&globalEnv, cx - 1, cy) || globalEnv.room[cx - 1][cy] != FLOOR);
+				hNeighbors += (!isInRoom(&globalEnv, cx + 1, cy) || globalEnv.room[cx + 1][cy] != FLOOR);
+				vNeighbors += (!isInRoom(&globalEnv, cx, cy - 1) || globalEnv.room[cx][cy - 1] != FLOOR);
+				vNeighbors += (!isInRoom(&globalEnv, cx, cy + 1) || globalEnv.room[cx][cy + 1] != FLOOR);
 			}
 
 			rgba topColor = fRGBA(.3, .1, 0, opacity);
@@ -1831,8 +3987,8 @@ void drawCell(char c, double x, double y, double size, double opacity, void *add
 			agent *aa = address;
 			double h = 0;
 			double p = 2 * pi;
-			if (aa >= &agents[0] && aa < &agents[numAgents]) {
-				h = (aa - &agents[0]) / (double)numAgents;
+			if (aa >= &globalEnv.agents[0] && aa < &globalEnv.agents[globalEnv.numAgents]) {
+				h = (aa - &globalEnv.agents[0]) / (double)globalEnv.numAgents;
 				p = 2 * pi * aa->health / MAX_HEALTH;
 			}
 
@@ -1872,22 +4028,24 @@ void drawCellQValues(int x, int y) {
 	// designed a bit better..
 	//@TODO fix above?
 	int fakeId = MAX_AGENTS - 1; // use the last agent
-	agent backup = agents[fakeId];
-	agents[fakeId].health = visualizeQTable;
-	agents[fakeId].x = x;
-	agents[fakeId].y = y;
+	agent backup = globalEnv.agents[fakeId];
+	globalEnv.agents[fakeId].health = visualizeQTable;
+	globalEnv.agents[fakeId].x = x;
+	globalEnv.agents[fakeId].y = y;
 
-	double *qA, *qB;
-	getQEntry(fakeId, &qA, &qB);
+	qentry *qA, *qB;
+	getQEntry(&globalEnv, fakeId, &qA, &qB);
 
 	// restore the old agent just in case
-	agents[fakeId] = backup;
+	globalEnv.agents[fakeId] = backup;
 
 	// get colors for each action in this cell for the current state
 	// red colors are used for negative values and green for positive
 	rgba actionColors[5];
 	for (action a = STAY; a <= UP; ++a) {
-		double q = useDoubleQ ? (qA[a] + qB[a]) / 2 : qA[a];
+		double q = globalLearner.useDoubleQ ?
+			(getQ(&globalLearner, qA, a) + getQ(&globalLearner, qB, a)) / 2 :
+			getQ(&globalLearner, qA, a);
 		double red   = q < 0;
 		double green = q > 0;
 		double opacity = 0;
@@ -1895,16 +4053,16 @@ void drawCellQValues(int x, int y) {
 		// we scale the color with sqrt to make the
 		// transition between 0 and visible a bit faster
 		if (q > 0) {
-			opacity = 0.5 * sqrt(q / escapeReward);
+			opacity = 0.5 * sqrt(q / globalLearner.escapeReward);
 		} else if (q < 0) {
-			opacity = 0.5 * sqrt(q / deathPunishment);
+			opacity = 0.5 * sqrt(q / globalLearner.deathPunishment);
 		}
 
 		actionColors[a] = fRGBA(red, green, 0, opacity);
 	}
 
 	// the best action is highlighted in blue
-	action bestAction = getBestAction(qA, qB);
+	action bestAction = getBestAction(&globalLearner, qA, qB);
 	rgba bestActionColor = fRGBA(0, 0, 1, 0.2);
 
 	// now we need to actually draw the values in
@@ -2049,16 +4207,17 @@ void drawEverything() {
 	grayscale = visualizeQTable != 0;
 
 	// draw the whole room
-	for (int x = 0; x < roomWidth; ++x) {
-		for (int y = 0; y < roomHeight; ++y) {
+	for (int x = 0; x < globalEnv.roomWidth; ++x) {
+		for (int y = 0; y < globalEnv.roomHeight; ++y) {
 			if (x * s + tx < windowWidth &&
 				y * s + ty < windowHeight &&
 				x * s + tx + s > 0 &&
 				y * s + ty + s > 0)
 			{
 				// the cell is only drawn if its visible
-				drawCell(room[x][y], x, y, 1, 1, &room[x][y]);
-				if (visualizeQTable != 0) {
+				drawCell(globalEnv.room[x][y], x, y, 1, 1, &globalEnv.room[x][y]);
+				// agents never stand on walls so there are no Q-values for them
+				if (visualizeQTable != 0 && globalLearner.cellOffset[x * MAX_ROOM_SIZE + y] != NONE) {
 					grayscale = FALSE;
 					drawCellQValues(x, y);
 					grayscale = TRUE;
@@ -2068,9 +4227,9 @@ void drawEverything() {
 	}
 
 	// draw all the agents
-	for (int a = 0; a < numAgents; ++a) {
-		double x = agents[a].x;
-		double y = agents[a].y;
+	for (int a = 0; a < globalEnv.numAgents; ++a) {
+		double x = globalEnv.agents[a].x;
+		double y = globalEnv.agents[a].y;
 
 		// if this agent is being dragged then render
 		// it at the position of the mouse
@@ -2085,14 +4244,14 @@ void drawEverything() {
 			y * s + ty + s > 0)
 		{
 			// the agent is only drawn if its visible
-			drawCell(AGENT, x, y, 1, 1, &agents[a]);
+			drawCell(AGENT, x, y, 1, 1, &globalEnv.agents[a]);
 		}
 	}
 
 	// highlight the cell with the mouse cursor
 	int x, y;
 	mouseCellPos(&x, &y);
-	if (isInRoom(x, y)) {
+	if (isInRoom(&globalEnv, x, y)) {
 		rgba color, borderColor;
 
 		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
@@ -2176,14 +4335,17 @@ void switchState(state newState) {
 	if (newState != uiState)  {
 		if (uiState == EDITING) {
 			selectCell(NONE);
-			currTurn = 0;
-			totalReward = 0;
+			globalEnv.currTurn = 0;
+			globalEnv.totalReward = 0;
+			globalEnv.numEscaped = 0;
 		}
 
 		if (newState == EDITING) {
-			memcpy(room, backupRoom, sizeof(room));
-			memcpy(agents, backupAgents, sizeof(agents));
-			currTurn = 0;
+			memcpy(globalEnv.room, globalEnv.backupRoom, sizeof(globalEnv.room));
+			memcpy(globalEnv.agents, globalEnv.backupAgents, sizeof(globalEnv.agents));
+			updateBoards(&globalEnv);
+			updateOccupancy(&globalEnv);
+			globalEnv.currTurn = 0;
 		}
 
 		printf("%s\n",
@@ -2199,15 +4361,15 @@ void switchState(state newState) {
 void centerCamera() {
 	double aspectRatio = (double)windowWidth / windowHeight;
 
-	if (roomWidth > aspectRatio * roomHeight) {
-		scale = (double)windowWidth / roomWidth;
-		transY = (windowHeight - scale * roomHeight) / 2;
+	if (globalEnv.roomWidth > aspectRatio * globalEnv.roomHeight) {
+		scale = (double)windowWidth / globalEnv.roomWidth;
+		transY = (windowHeight - scale * globalEnv.roomHeight) / 2;
 	} else {
-		scale = (double)windowHeight / roomHeight;
+		scale = (double)windowHeight / globalEnv.roomHeight;
 		transY = 0;
 	}
 
-	transX = (windowWidth - scale * roomWidth) / 2;
+	transX = (windowWidth - scale * globalEnv.roomWidth) / 2;
 }
 
 // fires when mouse button is pressed/released
@@ -2232,7 +4394,7 @@ void onMouseClick(GLFWwindow *w, int button, int action, int mods) {
 			mouseCellPos(&x, &y);
 
 			// check if we clicked on an agent
-			int a = agentAt(x, y);
+			int a = agentAt(&globalEnv, x, y);
 			if (a >= 0) {
 				performChange(REMOVE_AGENT, 0, 0, a, 1);
 			} else {
@@ -2242,29 +4404,29 @@ void onMouseClick(GLFWwindow *w, int button, int action, int mods) {
 			int x, y;
 			mouseCellPos(&x, &y);
 
-			if (isInRoom(x, y)) {
-				int a = agentAt(x, y);
+			if (isInRoom(&globalEnv, x, y)) {
+				int a = agentAt(&globalEnv, x, y);
 				if (selectedCell == AGENT) {
 					// check if we should start dragging this agent
 					if (a >= 0) {
 						draggedAgent = a;
-					} else if (!isPassable(room[x][y])) {
+					} else if (!isPassable(globalEnv.room[x][y])) {
 						printf("can't place Agent at (%d,%d) because %s is not passable\n",
-							x, y, toString(room[x][y]));
+							x, y, toString(globalEnv.room[x][y]));
 					} else {
-						if (!performChange(INSERT_AGENT, x, y, numAgents, 1)) {
+						if (!performChange(INSERT_AGENT, x, y, globalEnv.numAgents, 1)) {
 							printf("can't place Agent at (%d,%d) because another Agent is in the way\n", x, y);
 						}
 					}
-				} else if (selectedCell == GLASS && room[x][y] == GLASS) {
+				} else if (selectedCell == GLASS && globalEnv.room[x][y] == GLASS) {
 					performChange(REPLACE_CELL, x, y, SHARDS, 1);
-				} else if (selectedCell == GLASS && room[x][y] == SHARDS) {
+				} else if (selectedCell == GLASS && globalEnv.room[x][y] == SHARDS) {
 					performChange(REPLACE_CELL, x, y, GLASS, 1);
-				} else if (selectedCell == DOOR && room[x][y] == DOOR) {
+				} else if (selectedCell == DOOR && globalEnv.room[x][y] == DOOR) {
 					performChange(REPLACE_CELL, x, y, OPEN_DOOR, 1);
-				} else if (selectedCell == DOOR && room[x][y] == OPEN_DOOR) {
+				} else if (selectedCell == DOOR && globalEnv.room[x][y] == OPEN_DOOR) {
 					performChange(REPLACE_CELL, x, y, DOOR, 1);
-				} else if (agentAt(x, y) >= 0) {
+				} else if (agentAt(&globalEnv, x, y) >= 0) {
 					printf("can't place %s at (%d,%d) because and Agent is in the way\n",
 						toString(selectedCell), x, y);
 				} else {
@@ -2277,12 +4439,12 @@ void onMouseClick(GLFWwindow *w, int button, int action, int mods) {
 		} else if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
 			int x, y;
 			mouseCellPos(&x, &y);
-			if (isInRoom(x, y)) {
-				int a = agentAt(x, y);
+			if (isInRoom(&globalEnv, x, y)) {
+				int a = agentAt(&globalEnv, x, y);
 				if (a >= 0) {
 					selectCell(AGENT);
 				} else {
-					selectCell(room[x][y]);
+					selectCell(globalEnv.room[x][y]);
 				}
 			}
 			else {
@@ -2294,12 +4456,12 @@ void onMouseClick(GLFWwindow *w, int button, int action, int mods) {
 		if (draggedAgent != NONE) {
 			int x, y;
 			mouseCellPos(&x, &y);
-			if (x != agents[draggedAgent].x || y != agents[draggedAgent].y) {
-				if (!isInRoom(x, y)) {
+			if (x != globalEnv.agents[draggedAgent].x || y != globalEnv.agents[draggedAgent].y) {
+				if (!isInRoom(&globalEnv, x, y)) {
 					printf("can't move Agent outside of room\n");
-				} else if (!isPassable(room[x][y])) {
+				} else if (!isPassable(globalEnv.room[x][y])) {
 					printf("can't move Agent to (%d,%d) because %s is not passable\n",
-						x, y, toString(room[x][y]));
+						x, y, toString(globalEnv.room[x][y]));
 				} else if (performChange(INSERT_AGENT, x, y, draggedAgent, 2)) {
 					performChange(REMOVE_AGENT, 0, 0, draggedAgent + 1, 2);
 				} else {
@@ -2330,7 +4492,7 @@ void onMouseMove(GLFWwindow *w, double newX, double newY) {
 			int x, y;
 			mouseCellPos(&x, &y);
 			if (selectedCell == AGENT) {
-				performChange(INSERT_AGENT, x, y, numAgents, 1);
+				performChange(INSERT_AGENT, x, y, globalEnv.numAgents, 1);
 			} else {
 				performChange(REPLACE_CELL, x, y, selectedCell, 1);
 			}
@@ -2338,7 +4500,7 @@ void onMouseMove(GLFWwindow *w, double newX, double newY) {
 	} else if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
 		int x, y;
 		mouseCellPos(&x, &y);
-		int a = agentAt(x, y);
+		int a = agentAt(&globalEnv, x, y);
 		if (a == NONE) {
 			performChange(REPLACE_CELL, x, y, FLOOR, 1);
 		} else {
@@ -2415,7 +4577,7 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 				break;
 			case GLFW_KEY_PERIOD:
 				switchState(PAUSED);
-				simulateTurn();
+				simulateTurn(&globalEnv);
 				break;
 			case GLFW_KEY_Z:
 				if (mods & GLFW_MOD_CONTROL) {
@@ -2427,7 +4589,7 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 				} break;
 			case GLFW_KEY_S:
 				printf("the current room size is %dx%d.\n",
-					roomWidth, roomHeight);
+					globalEnv.roomWidth, globalEnv.roomHeight);
 				break;
 			case GLFW_KEY_EQUAL:
 				if (mods != 0) {
@@ -2438,8 +4600,8 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 					onScroll(window, 0, -1);
 				} break;
 			case GLFW_KEY_E:
-				useEpsilon = !useEpsilon;
-				if (useEpsilon) {
+				globalLearner.useEpsilon = !globalLearner.useEpsilon;
+				if (globalLearner.useEpsilon) {
 					printf("epsilon enabled\n");
 				} else {
 					printf("epsilon disabled\n");
@@ -2476,9 +4638,9 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 			} break;
 			case GLFW_KEY_Q: {
 				char command[64];
-				sprintf(command, "setq %lg", optimism);
+				sprintf(command, "setq %lg", globalLearner.optimism);
 				runCmd(command);
-				printf("Q-values set to %lg\n", optimism);
+				printf("Q-values set to %lg\n", globalLearner.optimism);
 			} break;
 			case GLFW_KEY_ENTER:
 			case GLFW_KEY_SPACE: {
@@ -2506,25 +4668,25 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 				if (mods != 0) {
 					transX += 16;
 				} else {
-					performChange(RESIZE_ROOM, roomWidth - 1, roomHeight, 0, 1);
+					performChange(RESIZE_ROOM, globalEnv.roomWidth - 1, globalEnv.roomHeight, 0, 1);
 				} break;
 			case GLFW_KEY_RIGHT:
 				if (mods != 0) {
 					transX -= 16;
 				} else {
-					performChange(RESIZE_ROOM, roomWidth + 1, roomHeight, 0, 1);
+					performChange(RESIZE_ROOM, globalEnv.roomWidth + 1, globalEnv.roomHeight, 0, 1);
 				} break;
 			case GLFW_KEY_UP:
 				if (mods != 0) {
 					transY -= 16;
 				} else {
-					performChange(RESIZE_ROOM, roomWidth, roomHeight + 1, 0, 1);
+					performChange(RESIZE_ROOM, globalEnv.roomWidth, globalEnv.roomHeight + 1, 0, 1);
 				} break;
 			case GLFW_KEY_DOWN:
 				if (mods != 0) {
 					transY += 16;
 				} else {
-					performChange(RESIZE_ROOM, roomWidth, roomHeight - 1, 0, 1);
+					performChange(RESIZE_ROOM, globalEnv.roomWidth, globalEnv.roomHeight - 1, 0, 1);
 				} break;
 			default: {
 				if (key >= GLFW_KEY_0 && key <= GLFW_KEY_9) {
@@ -2553,10 +4715,10 @@ void onKeyPress(GLFWwindow *w, int key, int scancode, int action, int mods) {
 // fires while window is being resized
 void onResize(GLFWwindow *w, int newWidth, int newHeight) {
 	if (scale == 0) {
-		scale = ((double)newHeight / roomHeight);
+		scale = ((double)newHeight / globalEnv.roomHeight);
 	} else {
-		scale /= ((double)windowHeight / roomHeight);
-		scale *= ((double)newHeight / roomHeight);
+		scale /= ((double)windowHeight / globalEnv.roomHeight);
+		scale *= ((double)newHeight / globalEnv.roomHeight);
 	}
 	windowWidth  = newWidth;
 	windowHeight = newHeight;
@@ -2617,7 +4779,7 @@ void runGUI() {
 			if (dt >= 1 / turnFreq || fastMode) {
 				t0 = t1;
 				for (int s = 0; s < turnsPerFrame; ++s) {
-					simulateTurn();
+					simulateTurn(&globalEnv);
 				}
 			}
 		} else {
@@ -2630,21 +4792,23 @@ void runGUI() {
 	}
 
 	// we are going to save the room to disk now, so restore the backup
-	if (currTurn > 0) {
-		memcpy(room, backupRoom, sizeof(room));
-		memcpy(agents, backupAgents, sizeof(agents));
+	if (globalEnv.currTurn > 0) {
+		memcpy(globalEnv.room, globalEnv.backupRoom, sizeof(globalEnv.room));
+		memcpy(globalEnv.agents, globalEnv.backupAgents, sizeof(globalEnv.agents));
+		updateBoards(&globalEnv);
+		updateOccupancy(&globalEnv);
 	}
 
 	// save room to room.txt
 	printf("saving room.txt ... ");
 	FILE *roomFile = fopen("room.txt", "wt");
 	if (roomFile != NULL) {
-		for (int y = roomHeight - 1; y >= 0; --y) {
-			for (int x = 0; x < roomWidth; ++x) {
-				if (agentAt(x, y) != NONE) {
+		for (int y = globalEnv.roomHeight - 1; y >= 0; --y) {
+			for (int x = 0; x < globalEnv.roomWidth; ++x) {
+				if (agentAt(&globalEnv, x, y) != NONE) {
 					fputc(AGENT, roomFile);
 				} else {
-					fputc(room[x][y], roomFile);
+					fputc(globalEnv.room[x][y], roomFile);
 				}
 			}
 			fputc('\n', roomFile);